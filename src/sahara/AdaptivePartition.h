@@ -0,0 +1,140 @@
+// SPDX-FileCopyrightText: 2006-2024, Knut Reinert & Freie Universität Berlin
+// SPDX-FileCopyrightText: 2016-2024, Knut Reinert & MPI für molekulare Genetik
+// SPDX-License-Identifier: BSD-3-Clause
+
+#pragma once
+
+#include "QGramCursors.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <fmindex-collection/fmindex-collection.h>
+#include <limits>
+#include <span>
+#include <vector>
+
+/* Number of occurrences of every string of length 1..q inside an index
+ *
+ * Built by walking the index for all strings up to length q, q is picked
+ * such that a single table has at most `maxEntries` entries. Ranks start at 1
+ * (rank 0 is the delimiter), codes are big-endian in base Sigma-1.
+ */
+template <size_t Sigma>
+struct QGramCountTable {
+    static constexpr size_t Letters = Sigma-1;
+
+    size_t q{};
+    std::vector<std::vector<uint32_t>> counts; // counts[d][code]
+
+    template <typename Index>
+    QGramCountTable(Index const& index, size_t maxEntries = size_t{1} << 20) {
+        size_t entries{Letters};
+        while (q < 16 && entries <= maxEntries) {
+            q += 1;
+            entries *= Letters;
+        }
+        counts.resize(q+1);
+        auto size = size_t{1};
+        for (size_t d{0}; d <= q; ++d) {
+            counts[d].resize(size, 0);
+            size *= Letters;
+        }
+        counts[0][0] = saturate(index.size());
+
+        forEachQGramCursor<Sigma, fmc::BiFMIndexCursor<Index>>(index, q, [&](auto const& cursor, size_t depth, size_t code) {
+            counts[depth][code] = saturate(cursor.count());
+        });
+    }
+
+    static auto saturate(size_t v) -> uint32_t {
+        return uint32_t(std::min<size_t>(v, std::numeric_limits<uint32_t>::max()));
+    }
+
+    static auto code(std::span<uint8_t const> s) -> size_t {
+        size_t c{};
+        for (auto r : s) {
+            c = c * Letters + (r - 1);
+        }
+        return c;
+    }
+
+    // estimated number of occurrences of a string, the smallest count of its q-grams
+    auto estimate(std::span<uint8_t const> s) const -> size_t {
+        for (auto r : s) {
+            if (r == 0 || r > Letters) return 0;
+        }
+        if (s.size() <= q) {
+            return counts[s.size()][code(s)];
+        }
+        auto best = std::numeric_limits<size_t>::max();
+        for (size_t i{0}; i + q <= s.size(); ++i) {
+            best = std::min<size_t>(best, counts[q][code(s.subspan(i, q))]);
+        }
+        return best;
+    }
+};
+
+/* A small set of partitions of the query into the parts of a search scheme
+ *
+ * Besides the base partition, each candidate enlarges one part by a fraction
+ * of the query, taken evenly from the other parts. Every query picks the
+ * candidate whose parts, which are searched first by the searches of the
+ * scheme, have the fewest estimated occurrences. Low complexity parts are
+ * thereby made longer.
+ */
+struct AdaptivePartitions {
+    std::vector<size_t>              firstParts; // first part of every search
+    std::vector<std::vector<size_t>> partitions; // candidates, partitions[0] is the base partition
+
+    AdaptivePartitions(fmc::search_scheme::Scheme const& oss, std::vector<size_t> const& base) {
+        for (auto const& s : oss) {
+            firstParts.push_back(s.pi[0]);
+        }
+        partitions.push_back(base);
+        size_t len{};
+        for (auto c : base) len += c;
+        auto parts = base.size();
+        if (parts < 2) return;
+        auto extra = std::max<size_t>(1, len / (2 * parts));
+        for (size_t i{0}; i < parts; ++i) {
+            auto p     = base;
+            auto taken = size_t{};
+            // take evenly from the other parts, keeping at least one position each
+            for (size_t round{0}; taken < extra && round < extra; ++round) {
+                for (size_t j{0}; j < parts && taken < extra; ++j) {
+                    if (j == i || p[j] <= 1) continue;
+                    p[j]  -= 1;
+                    taken += 1;
+                }
+            }
+            if (taken == 0) continue;
+            p[i] += taken;
+            partitions.push_back(p);
+        }
+    }
+
+    // index of the candidate partition for this query
+    template <typename Table>
+    auto choose(std::span<uint8_t const> query, Table const& table) const -> size_t {
+        size_t len{};
+        for (auto c : partitions[0]) len += c;
+        if (query.size() != len) return 0;
+
+        auto best      = size_t{};
+        auto bestScore = std::numeric_limits<double>::max();
+        for (size_t i{0}; i < partitions.size(); ++i) {
+            auto const& p = partitions[i];
+            auto score = 0.;
+            for (auto part : firstParts) {
+                size_t start{};
+                for (size_t j{0}; j < part; ++j) start += p[j];
+                score += table.estimate(query.subspan(start, p[part]));
+            }
+            if (score < bestScore) {
+                bestScore = score;
+                best      = i;
+            }
+        }
+        return best;
+    }
+};
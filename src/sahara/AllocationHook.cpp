@@ -0,0 +1,77 @@
+// SPDX-FileCopyrightText: 2006-2024, Knut Reinert & Freie Universität Berlin
+// SPDX-FileCopyrightText: 2016-2024, Knut Reinert & MPI für molekulare Genetik
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include "utils/AllocationStats.h"
+
+#include <cstdlib>
+#include <new>
+
+namespace allocation_stats {
+std::atomic<bool>     enabled{false};
+std::atomic<uint64_t> count{};
+std::atomic<uint64_t> bytes{};
+}
+
+namespace {
+void record(std::size_t size) {
+    if (allocation_stats::enabled.load(std::memory_order_relaxed)) {
+        allocation_stats::count.fetch_add(1, std::memory_order_relaxed);
+        allocation_stats::bytes.fetch_add(size, std::memory_order_relaxed);
+    }
+}
+
+auto allocate(std::size_t size) noexcept -> void* {
+    record(size);
+    return std::malloc(size ? size : 1);
+}
+
+auto allocateAligned(std::size_t size, std::align_val_t al) noexcept -> void* {
+    record(size);
+    auto alignment = static_cast<std::size_t>(al);
+    auto rounded   = (size + alignment - 1) / alignment * alignment;
+    return std::aligned_alloc(alignment, rounded ? rounded : alignment);
+}
+}
+
+void* operator new(std::size_t size) {
+    if (auto ptr = allocate(size)) return ptr;
+    throw std::bad_alloc{};
+}
+void* operator new[](std::size_t size) {
+    if (auto ptr = allocate(size)) return ptr;
+    throw std::bad_alloc{};
+}
+void* operator new(std::size_t size, std::nothrow_t const&) noexcept {
+    return allocate(size);
+}
+void* operator new[](std::size_t size, std::nothrow_t const&) noexcept {
+    return allocate(size);
+}
+void* operator new(std::size_t size, std::align_val_t al) {
+    if (auto ptr = allocateAligned(size, al)) return ptr;
+    throw std::bad_alloc{};
+}
+void* operator new[](std::size_t size, std::align_val_t al) {
+    if (auto ptr = allocateAligned(size, al)) return ptr;
+    throw std::bad_alloc{};
+}
+void* operator new(std::size_t size, std::align_val_t al, std::nothrow_t const&) noexcept {
+    return allocateAligned(size, al);
+}
+void* operator new[](std::size_t size, std::align_val_t al, std::nothrow_t const&) noexcept {
+    return allocateAligned(size, al);
+}
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::nothrow_t const&) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, std::nothrow_t const&) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, std::size_t, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::align_val_t, std::nothrow_t const&) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, std::align_val_t, std::nothrow_t const&) noexcept { std::free(ptr); }
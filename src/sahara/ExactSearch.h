@@ -0,0 +1,98 @@
+// SPDX-FileCopyrightText: 2006-2024, Knut Reinert & Freie Universität Berlin
+// SPDX-FileCopyrightText: 2016-2024, Knut Reinert & MPI für molekulare Genetik
+// SPDX-License-Identifier: BSD-3-Clause
+
+#pragma once
+
+#include "QGramCursors.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <fmindex-collection/fmindex-collection.h>
+#include <span>
+#include <tuple>
+#include <vector>
+
+/* Exact matching on a bidirectional index
+ *
+ * Uses plain backward search with a cursor that only maintains the forward
+ * interval (as on a unidirectional index). The intervals of all q-grams are
+ * looked up in a table, which replaces the first q extensions. Queries are
+ * processed in batches, extending every query of a batch by one symbol per
+ * round, such that the independent rank queries of different queries overlap
+ * in memory.
+ */
+template <size_t Sigma, typename Index>
+struct ExactSearch {
+    static constexpr size_t Letters   = Sigma-1; // rank 0 is the delimiter
+    static constexpr size_t BatchSize = 16;
+
+    using Cursor = fmc::LeftBiFMIndexCursor<Index>;
+
+    Index const& index;
+    size_t q{};
+    std::vector<Cursor> table; // cursor of every q-gram, big-endian code in base Letters
+
+    ExactSearch(Index const& _index, size_t maxEntries = size_t{1} << 18)
+        : index{_index}
+    {
+        size_t entries{Letters};
+        while (entries <= maxEntries && entries <= index.size()) {
+            q += 1;
+            entries *= Letters;
+        }
+        if (q == 0) return;
+        auto empty = Cursor{index};
+        empty.len  = 0;
+        table.resize(entries / Letters, empty);
+
+        forEachQGramCursor<Sigma, Cursor>(index, q, [&](Cursor const& cursor, size_t depth, size_t code) {
+            if (depth == q) table[code] = cursor;
+        });
+    }
+
+    // cursor after looking up the last q symbols of the query, and the number of symbols left to extend
+    auto start(std::span<uint8_t const> query) const -> std::tuple<Cursor, size_t> {
+        if (q == 0 || query.size() < q) {
+            return {Cursor{index}, query.size()};
+        }
+        size_t code{};
+        for (auto r : query.subspan(query.size() - q)) {
+            if (r == 0 || r > Letters) return {Cursor{index}, query.size()};
+            code = code * Letters + (r - 1);
+        }
+        return {table[code], query.size() - q};
+    }
+
+    /* Calls cb(queryId, cursor, 0) for every query with at least one
+     * occurrence, the cursor's lb and len describe the occurrences.
+     */
+    template <typename Queries, typename CB>
+    void search(Queries const& queries, CB&& cb) const {
+        auto cursors = std::vector<Cursor>(BatchSize, Cursor{index});
+        auto left    = std::array<size_t, BatchSize>{}; // symbols left to extend
+        for (size_t begin{0}; begin < queries.size(); begin += BatchSize) {
+            auto n = std::min(BatchSize, queries.size() - begin);
+            for (size_t i{0}; i < n; ++i) {
+                std::tie(cursors[i], left[i]) = start(queries[begin+i]);
+            }
+            // one symbol of every unfinished query per round
+            bool active{true};
+            while (active) {
+                active = false;
+                for (size_t i{0}; i < n; ++i) {
+                    if (left[i] == 0 || cursors[i].len == 0) continue;
+                    left[i] -= 1;
+                    cursors[i] = cursors[i].extendLeft(queries[begin+i][left[i]]);
+                    active = true;
+                }
+            }
+            for (size_t i{0}; i < n; ++i) {
+                if (cursors[i].len > 0) {
+                    cb(begin+i, cursors[i], size_t{0});
+                }
+            }
+        }
+    }
+};
@@ -0,0 +1,89 @@
+// SPDX-FileCopyrightText: 2006-2024, Knut Reinert & Freie Universität Berlin
+// SPDX-FileCopyrightText: 2016-2024, Knut Reinert & MPI für molekulare Genetik
+// SPDX-License-Identifier: BSD-3-Clause
+
+#pragma once
+
+#include "utils/error_fmt.h"
+
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <vector>
+
+/* Storage for search hits (suffix array intervals) before they are located.
+ *
+ * Hits are kept as structure-of-arrays in fixed size chunks. A full chunk is
+ * never touched again, so growing the buffer never copies or reallocates
+ * existing hits. Each hit needs 21 bytes (query id, lb, len, errors), instead
+ * of a full cursor copy.
+ *
+ * A buffer is meant to be filled by a single thread, multithreaded searches
+ * use one buffer per thread.
+ */
+struct HitBuffer {
+    static constexpr size_t ChunkSize = size_t{1} << 16;
+
+private:
+    struct Chunk {
+        std::unique_ptr<uint32_t[]> queryId = std::make_unique_for_overwrite<uint32_t[]>(ChunkSize);
+        std::unique_ptr<uint64_t[]> lb      = std::make_unique_for_overwrite<uint64_t[]>(ChunkSize);
+        std::unique_ptr<uint64_t[]> len     = std::make_unique_for_overwrite<uint64_t[]>(ChunkSize);
+        std::unique_ptr<uint8_t[]>  errors  = std::make_unique_for_overwrite<uint8_t[]>(ChunkSize);
+        size_t size{};
+    };
+
+    std::vector<Chunk> chunks;
+    size_t totalHits{};
+    size_t totalRows{};
+
+public:
+    void push(size_t queryId, size_t lb, size_t len, size_t errors) {
+        if (queryId > std::numeric_limits<uint32_t>::max()) {
+            throw error_fmt{"query id {} exceeds the supported number of queries", queryId};
+        }
+        if (chunks.empty() || chunks.back().size == ChunkSize) {
+            chunks.emplace_back();
+        }
+        auto& c = chunks.back();
+        c.queryId[c.size] = queryId;
+        c.lb[c.size]      = lb;
+        c.len[c.size]     = len;
+        c.errors[c.size]  = errors;
+        c.size += 1;
+        totalHits += 1;
+        totalRows += len;
+    }
+
+    // number of stored intervals
+    auto size() const -> size_t {
+        return totalHits;
+    }
+
+    // sum of all interval lengths (number of positions after locating)
+    auto rows() const -> size_t {
+        return totalRows;
+    }
+
+    // memory used by all allocated chunks
+    auto bytes() const -> size_t {
+        return chunks.size() * ChunkSize * (sizeof(uint32_t) + 2 * sizeof(uint64_t) + sizeof(uint8_t));
+    }
+
+    // calls cb(queryId, lb, len, errors) for every hit in insertion order
+    template <typename CB>
+    void forEach(CB&& cb) const {
+        for (auto const& c : chunks) {
+            for (size_t i{0}; i < c.size; ++i) {
+                cb(size_t{c.queryId[i]}, size_t{c.lb[i]}, size_t{c.len[i]}, size_t{c.errors[i]});
+            }
+        }
+    }
+
+    // non-owning callback, which can be handed to the search engines
+    auto sink() {
+        return [this](size_t queryId, auto const& cursor, size_t errors) {
+            push(queryId, cursor.lb, cursor.len, errors);
+        };
+    }
+};
@@ -0,0 +1,104 @@
+// SPDX-FileCopyrightText: 2006-2024, Knut Reinert & Freie Universität Berlin
+// SPDX-FileCopyrightText: 2016-2024, Knut Reinert & MPI für molekulare Genetik
+// SPDX-License-Identifier: BSD-3-Clause
+
+#pragma once
+
+#include "utils/error_fmt.h"
+
+#include <cereal/archives/binary.hpp>
+#include <cereal/types/string.hpp>
+#include <cereal/types/vector.hpp>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+/* An index can be stored as a single file (sigma followed by the BiFMIndex) or
+ * as multiple segments (shards), each being such a single index file over a
+ * consecutive range of reference records. In the later case the `.idx` file is
+ * a manifest, listing all segments and the global id of their first reference.
+ *
+ * A manifest is recognized by its first 8 bytes, which would hold sigma in a
+ * single index file.
+ */
+struct IndexManifest {
+    static constexpr uint64_t Magic = 0x5341'4841'5241'5347; // "SAHARASG"
+
+    struct Segment {
+        std::string path;      // relative to the manifest file
+        size_t firstRefId{};   // global id of the first reference inside this segment
+        size_t refCount{};     // number of references inside this segment
+        size_t indexSize{};    // index.size() of this segment
+        size_t fileSize{};     // size of the segment file in bytes
+
+        template <typename Archive>
+        void serialize(Archive& ar) {
+            ar(path, firstRefId, refCount, indexSize, fileSize);
+        }
+    };
+
+    size_t sigma{};
+    std::vector<Segment> segments;
+
+    auto refCount() const -> size_t {
+        if (segments.empty()) return 0;
+        return segments.back().firstRefId + segments.back().refCount;
+    }
+
+    auto indexSize() const -> size_t {
+        size_t s{};
+        for (auto const& seg : segments) {
+            s += seg.indexSize;
+        }
+        return s;
+    }
+
+    // path of a segment, resolved relative to the manifest
+    static auto segmentPath(std::filesystem::path const& manifestPath, Segment const& seg) -> std::filesystem::path {
+        return manifestPath.parent_path() / seg.path;
+    }
+
+    static auto isManifest(std::filesystem::path const& path) -> bool {
+        auto ifs     = std::ifstream{path, std::ios::binary};
+        auto archive = cereal::BinaryInputArchive{ifs};
+        uint64_t magic{};
+        archive(magic);
+        return magic == Magic;
+    }
+
+    void save(std::filesystem::path const& path) const {
+        auto ofs     = std::ofstream{path, std::ios::binary};
+        auto archive = cereal::BinaryOutputArchive{ofs};
+        archive(Magic, sigma, segments);
+    }
+
+    /* Loads a manifest, if the path is a single index file a manifest with a
+     * single segment is generated. In this case indexSize and refCount are
+     * unknown (0) until the index itself is loaded.
+     */
+    static auto load(std::filesystem::path const& path) -> IndexManifest {
+        auto manifest = IndexManifest{};
+        auto ifs     = std::ifstream{path, std::ios::binary};
+        auto archive = cereal::BinaryInputArchive{ifs};
+        uint64_t magic{};
+        archive(magic);
+        if (magic == Magic) {
+            archive(manifest.sigma, manifest.segments);
+            if (manifest.segments.empty()) {
+                throw error_fmt{"index manifest {} has no segments", path};
+            }
+            return manifest;
+        }
+        manifest.sigma = magic;
+        manifest.segments.push_back(Segment{
+            .path       = path.filename().string(),
+            .firstRefId = 0,
+            .refCount   = 0,
+            .indexSize  = 0,
+            .fileSize   = std::filesystem::file_size(path),
+        });
+        return manifest;
+    }
+};
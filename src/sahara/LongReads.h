@@ -0,0 +1,154 @@
+// SPDX-FileCopyrightText: 2006-2024, Knut Reinert & Freie Universität Berlin
+// SPDX-FileCopyrightText: 2016-2024, Knut Reinert & MPI für molekulare Genetik
+// SPDX-License-Identifier: BSD-3-Clause
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <tuple>
+#include <vector>
+
+/* Splits long reads into overlapping segments of equal length
+ *
+ * Segments start every `stride` positions, the last segment of a read ends at
+ * the end of the read. Reads shorter than a segment are skipped. The segments
+ * are views into the reads, they are searched like ordinary queries.
+ */
+struct ReadSegments {
+    size_t segmentLength;
+    size_t stride;
+    std::vector<std::span<uint8_t const>> segments;
+    std::vector<size_t> read;       // read of every segment
+    std::vector<size_t> offset;     // start of every segment inside its read
+    std::vector<size_t> readLength; // length of every read
+    size_t skipped{};               // reads shorter than a segment
+
+    ReadSegments(std::vector<std::span<uint8_t const>> const& reads, size_t _segmentLength, size_t _stride)
+        : segmentLength{_segmentLength}
+        , stride{std::max<size_t>(1, _stride)}
+    {
+        for (size_t r{0}; r < reads.size(); ++r) {
+            auto const& seq = reads[r];
+            readLength.push_back(seq.size());
+            if (seq.size() < segmentLength) {
+                skipped += 1;
+                continue;
+            }
+            for (size_t pos{0};; pos += stride) {
+                pos = std::min(pos, seq.size() - segmentLength);
+                segments.push_back(seq.subspan(pos, segmentLength));
+                read.push_back(r);
+                offset.push_back(pos);
+                if (pos + segmentLength == seq.size()) break;
+            }
+        }
+    }
+};
+
+/* Colinear chaining of located segment hits
+ *
+ * An anchor is a segment hit, a chain is a sequence of anchors of one read on
+ * one reference sequence whose read and reference positions both increase.
+ * Chains are scored like in minimap2: every anchor adds the number of new
+ * positions it covers (at most a segment length, reduced by its fraction of
+ * errors), such that skipping overlapping anchors never pays off, and a gap
+ * of g positions between the read and the reference distance costs
+ * 0.01*segmentLength*g + 0.5*log2(g). Only the last `lookback` anchors are
+ * considered as predecessors, which keeps the chaining linear in practice.
+ * A chain covering the whole read is reported even below the minimal score,
+ * otherwise reads too short to reach it could never be mapped.
+ */
+namespace chaining {
+
+struct Anchor {
+    size_t seqId;
+    size_t refPos;
+    size_t readPos;
+    size_t errors;
+};
+
+struct Chain {
+    size_t seqId;
+    size_t refStart, refEnd;   // reference positions covered by the anchors
+    size_t readStart, readEnd; // read positions covered by the anchors
+    double score;
+    size_t anchors;
+};
+
+struct Parameters {
+    size_t segmentLength;
+    size_t maxGap;        // maximal read or reference distance of neighbouring anchors
+    size_t bandwidth;     // maximal difference of the read and the reference distance
+    size_t lookback{50};
+    double minScore;      // chains covering the whole read are kept regardless
+    size_t maxChains;     // chains reported per read, best first
+};
+
+// chains the anchors of a single read, anchors are reordered
+inline auto chain(std::vector<Anchor>& anchors, size_t readLength, Parameters const& params) -> std::vector<Chain> {
+    std::ranges::sort(anchors, [](auto const& lhs, auto const& rhs) {
+        return std::tie(lhs.seqId, lhs.refPos, lhs.readPos) < std::tie(rhs.seqId, rhs.refPos, rhs.readPos);
+    });
+    auto L = params.segmentLength;
+    auto n = anchors.size();
+    auto none  = std::numeric_limits<size_t>::max();
+    auto score = std::vector<double>(n);
+    auto pred  = std::vector<size_t>(n, none);
+    for (size_t i{0}; i < n; ++i) {
+        auto const& a = anchors[i];
+        score[i] = double(L) - double(a.errors);
+        for (size_t j{i}; j > 0 && i - j < params.lookback;) {
+            --j;
+            auto const& b = anchors[j];
+            if (b.seqId != a.seqId) break;
+            auto dr = a.refPos - b.refPos;
+            if (dr > params.maxGap) break; // anchors are sorted by reference position
+            if (dr == 0 || a.readPos <= b.readPos) continue;
+            auto dq = a.readPos - b.readPos;
+            if (dq > params.maxGap) continue;
+            auto gap = dr > dq ? dr - dq : dq - dr;
+            if (gap > params.bandwidth) continue;
+            auto cost = gap == 0 ? 0. : 0.01 * L * gap + 0.5 * std::log2(double(gap));
+            auto cov  = std::min({dq, dr, L});
+            auto s    = score[j] + double(cov) * (1. - double(a.errors) / L) - cost;
+            if (s > score[i]) {
+                score[i] = s;
+                pred[i]  = j;
+            }
+        }
+    }
+
+    // best chains first, anchors belong to at most one chain
+    auto order = std::vector<size_t>(n);
+    for (size_t i{0}; i < n; ++i) order[i] = i;
+    std::ranges::sort(order, [&](size_t lhs, size_t rhs) { return score[lhs] > score[rhs]; });
+    auto used   = std::vector<bool>(n);
+    auto chains = std::vector<Chain>{};
+    for (auto end : order) {
+        if (chains.size() == params.maxChains) break;
+        if (used[end]) continue;
+        auto first = end;
+        auto count = size_t{};
+        auto i     = end;
+        for (; i != none && !used[i]; i = pred[i]) {
+            used[i] = true;
+            first   = i;
+            count  += 1;
+        }
+        // a chain running into another chain only keeps its own part
+        auto s = score[end] - (i == none ? 0. : score[i]);
+        auto const& a = anchors[first];
+        auto const& b = anchors[end];
+        auto wholeRead = a.readPos == 0 && b.readPos + L == readLength;
+        if (s < params.minScore && !wholeRead) continue;
+        chains.push_back({a.seqId, a.refPos, b.refPos + L, a.readPos, b.readPos + L, s, count});
+    }
+    std::ranges::sort(chains, [](auto const& lhs, auto const& rhs) { return lhs.score > rhs.score; });
+    return chains;
+}
+
+}
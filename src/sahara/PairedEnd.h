@@ -0,0 +1,171 @@
+// SPDX-FileCopyrightText: 2006-2024, Knut Reinert & Freie Universität Berlin
+// SPDX-FileCopyrightText: 2016-2024, Knut Reinert & MPI für molekulare Genetik
+// SPDX-License-Identifier: BSD-3-Clause
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <span>
+#include <tuple>
+#include <vector>
+
+/* Pairing of the hits of paired-end reads
+ *
+ * Mates are expected in forward-reverse orientation: one mate maps to the
+ * forward strand, the other one downstream to the reverse strand. The insert
+ * size is the distance from the start of the forward mate to the end of the
+ * reverse mate.
+ */
+namespace paired_end {
+
+struct MateHit {
+    size_t seqId;
+    size_t pos;
+    bool   reverse; // the reverse complement of the mate matched
+    size_t errors;
+};
+
+/* Insert size distribution, learned from pairs whose mates both have a
+ * single hit in forward-reverse orientation. Median and the median absolute
+ * deviation are used, such that a few chimeric pairs do not widen the range.
+ */
+struct InsertSizeModel {
+    size_t samples{};
+    double median{};
+    double sd{};
+    size_t lo{};
+    size_t hi{};
+
+    static auto learn(std::vector<size_t> inserts, size_t maxInsert, double deviations = 4.) -> InsertSizeModel {
+        auto model = InsertSizeModel{.samples = inserts.size(), .lo = 0, .hi = maxInsert};
+        if (inserts.size() < 10) return model;
+        auto median = [](std::vector<double> v) {
+            std::ranges::nth_element(v, v.begin() + v.size() / 2);
+            return v[v.size() / 2];
+        };
+        auto values = std::vector<double>(inserts.begin(), inserts.end());
+        model.median = median(values);
+        for (auto& v : values) {
+            v = std::abs(v - model.median);
+        }
+        model.sd = std::max(1., 1.4826 * median(values)); // MAD of a normal distribution
+        model.lo = size_t(std::max(0., model.median - deviations * model.sd));
+        model.hi = size_t(model.median + deviations * model.sd);
+        return model;
+    }
+};
+
+// insert size of a forward and a downstream reverse hit, if they form a pair
+inline auto insertSize(MateHit const& fwd, MateHit const& rev, size_t revLength) -> std::optional<size_t> {
+    if (fwd.reverse || !rev.reverse || fwd.seqId != rev.seqId) return std::nullopt;
+    if (rev.pos + revLength < fwd.pos) return std::nullopt;
+    return rev.pos + revLength - fwd.pos;
+}
+
+struct Pair {
+    std::optional<MateHit> mate1;
+    std::optional<MateHit> mate2;
+    size_t insert{};
+    bool   proper{};  // both mates in orientation and inside the insert size range
+    bool   rescued{}; // the hit of one mate was found by verification near the other
+};
+
+/* Proper pairs with the fewest errors (at most maxPairs), for each hit of
+ * one mate the hits of the other mate are found by binary search inside the
+ * insert size window.
+ */
+inline auto properPairs(std::vector<MateHit> hits1, std::vector<MateHit> hits2,
+                        size_t len1, size_t len2, InsertSizeModel const& model, size_t maxPairs) -> std::vector<Pair> {
+    auto key = [](MateHit const& h) { return std::tuple{h.seqId, h.reverse, h.pos}; };
+    std::ranges::sort(hits1, [&](auto const& a, auto const& b) { return key(a) < key(b); });
+    std::ranges::sort(hits2, [&](auto const& a, auto const& b) { return key(a) < key(b); });
+
+    auto pairs = std::vector<Pair>{};
+    // fwd hits of one mate, searched for rev hits of the other mate
+    auto collect = [&](auto const& fwdHits, auto const& revHits, size_t revLength, bool fwdIsMate1) {
+        for (auto const& f : fwdHits) {
+            if (f.reverse) continue;
+            // rev.pos + revLength - f.pos in [lo, hi]
+            auto first = f.pos + model.lo < revLength ? 0 : f.pos + model.lo - revLength;
+            auto last  = f.pos + model.hi < revLength ? 0 : f.pos + model.hi - revLength;
+            auto begin = std::ranges::lower_bound(revHits, std::tuple{f.seqId, true, first}, {}, key);
+            for (auto iter = begin; iter != revHits.end() && iter->seqId == f.seqId && iter->reverse && iter->pos <= last; ++iter) {
+                auto insert = insertSize(f, *iter, revLength);
+                if (!insert || *insert < model.lo || *insert > model.hi) continue;
+                if (fwdIsMate1) pairs.push_back({f, *iter, *insert, /*proper=*/true, /*rescued=*/false});
+                else            pairs.push_back({*iter, f, *insert, /*proper=*/true, /*rescued=*/false});
+            }
+        }
+    };
+    collect(hits1, hits2, len2, true);
+    collect(hits2, hits1, len1, false);
+
+    auto errors = [](Pair const& p) { return p.mate1->errors + p.mate2->errors; };
+    std::ranges::stable_sort(pairs, [&](auto const& a, auto const& b) { return errors(a) < errors(b); });
+    if (pairs.size() > maxPairs) pairs.resize(maxPairs);
+    return pairs;
+}
+
+/* Best occurrence of the query inside the text with at most k errors, as
+ * (start position, errors). Semi-global alignment: the query has to align
+ * completely, the text is free at both ends. With Edit unset only
+ * substitutions are allowed.
+ */
+template <bool Edit>
+auto verify(std::span<uint8_t const> text, std::span<uint8_t const> query, size_t k) -> std::optional<std::tuple<size_t, size_t>> {
+    auto m = query.size();
+    auto best = std::optional<std::tuple<size_t, size_t>>{};
+    if constexpr (!Edit) {
+        for (size_t start{0}; start + m <= text.size(); ++start) {
+            size_t e{};
+            for (size_t i{0}; i < m && e <= k; ++i) {
+                e += text[start+i] != query[i];
+            }
+            if (e <= k && (!best || e < std::get<1>(*best))) {
+                best = {start, e};
+            }
+        }
+    } else {
+        // one column per text position, cells hold (errors, start of the alignment)
+        auto col  = std::vector<std::tuple<size_t, size_t>>(m+1);
+        auto next = col;
+        for (size_t i{0}; i <= m; ++i) col[i] = {i, 0};
+        for (size_t j{0}; j < text.size(); ++j) {
+            next[0] = {0, j+1};
+            for (size_t i{1}; i <= m; ++i) {
+                auto diag = std::tuple{std::get<0>(col[i-1]) + (text[j] != query[i-1]), std::get<1>(col[i-1])};
+                auto up   = std::tuple{std::get<0>(next[i-1]) + 1, std::get<1>(next[i-1])}; // insertion in the query
+                auto left = std::tuple{std::get<0>(col[i]) + 1, std::get<1>(col[i])};       // deletion in the query
+                next[i] = std::min({diag, up, left});
+            }
+            std::swap(col, next);
+            auto [e, start] = col[m];
+            if (e <= k && (!best || e < std::get<1>(*best))) {
+                best = {start, e};
+            }
+        }
+    }
+    return best;
+}
+
+/* Reference window [begin, end) that contains the other mate, if the pair
+ * is inside the insert size range (without slack for indels)
+ */
+inline auto rescueWindow(MateHit const& anchor, size_t anchorLength, size_t mateLength, InsertSizeModel const& model) -> std::tuple<size_t, size_t> {
+    if (!anchor.reverse) {
+        // mate is reverse, ends in [anchor.pos + lo, anchor.pos + hi]
+        auto begin = anchor.pos + model.lo < mateLength ? 0 : anchor.pos + model.lo - mateLength;
+        return {begin, anchor.pos + model.hi};
+    }
+    // mate is forward, starts in [anchorEnd - hi, anchorEnd - lo]
+    auto anchorEnd = anchor.pos + anchorLength;
+    auto begin     = anchorEnd < model.hi ? 0 : anchorEnd - model.hi;
+    auto last      = anchorEnd < model.lo ? 0 : anchorEnd - model.lo;
+    return {begin, last + mateLength};
+}
+
+}
@@ -0,0 +1,32 @@
+// SPDX-FileCopyrightText: 2006-2024, Knut Reinert & Freie Universität Berlin
+// SPDX-FileCopyrightText: 2016-2024, Knut Reinert & MPI für molekulare Genetik
+// SPDX-License-Identifier: BSD-3-Clause
+
+#pragma once
+
+#include <cstddef>
+
+/* Visits the cursor of every string of length 1..q occurring in the index
+ *
+ * The strings are walked depth first by extending to the left, strings
+ * without occurrences are not visited and not extended further. Calls
+ * cb(cursor, length, code) with the big-endian code of the string in base
+ * Sigma-1, ranks start at 1 (rank 0 is the delimiter).
+ */
+template <size_t Sigma, typename Cursor, typename Index, typename CB>
+void forEachQGramCursor(Index const& index, size_t q, CB&& cb) {
+    constexpr size_t Letters = Sigma-1;
+
+    // extending to the left prepends a symbol: code(c w) = c * Letters^|w| + code(w)
+    auto walk = [&](auto& self, Cursor const& cursor, size_t depth, size_t code, size_t power) -> void {
+        if (depth == q) return;
+        for (size_t c{0}; c < Letters; ++c) {
+            auto next = cursor.extendLeft(c+1);
+            if (next.count() == 0) continue;
+            auto nextCode = c * power + code;
+            cb(next, depth+1, nextCode);
+            self(self, next, depth+1, nextCode, power * Letters);
+        }
+    };
+    walk(walk, Cursor{index}, 0, 0, 1);
+}
@@ -0,0 +1,254 @@
+// SPDX-FileCopyrightText: 2006-2024, Knut Reinert & Freie Universität Berlin
+// SPDX-FileCopyrightText: 2016-2024, Knut Reinert & MPI für molekulare Genetik
+// SPDX-License-Identifier: BSD-3-Clause
+
+#pragma once
+
+#include "utils/Json.h"
+#include "utils/error_fmt.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fmindex-collection/search_scheme/all.h>
+#include <fmt/ranges.h>
+#include <vector>
+
+/* Occurrence statistics of the q-grams of a reference
+ *
+ * occupancy[d] is the fraction of all strings of length d (over the letters,
+ * without delimiter) that occur in the reference. It replaces the uniform
+ * text model min(1, N/sigma^d) of the weighted node count: on repetitive
+ * references far less strings of a given length occur than the uniform model
+ * predicts. Beyond q the occupancy decays like the uniform model.
+ *
+ * The statistics are written by `sahara index --qgram_stats <q>` next to the
+ * index as "<index>.qgrams.json".
+ */
+struct QGramStats {
+    size_t              letters{};    // alphabet size without delimiter
+    size_t              textLength{}; // number of letters of the reference
+    std::vector<double> occupancy;    // d = 0..q
+
+    static auto path(std::filesystem::path const& indexPath) -> std::filesystem::path {
+        return indexPath.string() + ".qgrams.json";
+    }
+
+    auto q() const -> size_t {
+        return occupancy.empty() ? 0 : occupancy.size() - 1;
+    }
+
+    // probability that a string of length `depth` occurs in the reference
+    auto weight(size_t depth) const -> long double {
+        auto uniform = [&](size_t d) {
+            return std::min<long double>(1., textLength / std::pow((long double)letters, (long double)d));
+        };
+        if (depth <= q()) {
+            return occupancy[depth];
+        }
+        auto base = uniform(q());
+        if (base <= 0.) return 0.;
+        return occupancy.back() * uniform(depth) / base;
+    }
+
+    static auto load(std::filesystem::path const& path) -> QGramStats {
+        auto json  = JsonValue::load(path);
+        auto stats = QGramStats{};
+        auto letters    = json.find("letters");
+        auto textLength = json.find("text_length");
+        auto occupancy  = json.find("occupancy");
+        if (!letters || !textLength || !occupancy) {
+            throw error_fmt{"{} is not a q-gram statistics file", path};
+        }
+        stats.letters    = size_t(letters->number);
+        stats.textLength = size_t(textLength->number);
+        for (auto const& v : occupancy->array) {
+            stats.occupancy.push_back(v.number);
+        }
+        return stats;
+    }
+
+    void save(std::filesystem::path const& path) const {
+        auto ofs = fopen(path.c_str(), "w");
+        if (!ofs) {
+            throw error_fmt{"failed opening file {}", path};
+        }
+        fmt::print(ofs, "{{\n  \"letters\": {},\n  \"text_length\": {},\n  \"occupancy\": [{}]\n}}\n",
+                   letters, textLength, fmt::join(occupancy, ", "));
+        fclose(ofs);
+    }
+};
+
+/* Collects the distinct q-grams of all lengths 1..q of the references
+ *
+ * Every length keeps a bit vector over all letters^d strings, so q is limited
+ * such that the largest one has at most 2^MaxBits entries. Ranks are shifted
+ * by `firstRank` (the delimiter has rank 0), other ranks break q-grams.
+ * The references are scanned while loading them, before an index exists to
+ * walk with forEachQGramCursor().
+ */
+struct QGramCounter {
+    static constexpr size_t MaxBits = 30;
+
+    size_t letters;
+    size_t firstRank;
+    size_t q;
+    size_t textLength{};
+    std::vector<std::vector<uint64_t>> seen; // seen[d][code]
+
+    QGramCounter(size_t _letters, size_t _firstRank, size_t _q)
+        : letters{_letters}
+        , firstRank{_firstRank}
+        , q{_q}
+    {
+        auto size = size_t{1};
+        seen.resize(1);
+        for (size_t d{1}; d <= q; ++d) {
+            if (std::bit_width(size * letters) > MaxBits) {
+                q = d-1;
+                break;
+            }
+            size *= letters;
+            seen.emplace_back((size+63)/64, 0);
+        }
+    }
+
+    template <typename Range>
+    void add(Range const& seq) {
+        textLength += seq.size();
+        auto codes = std::vector<size_t>(q+1, 0); // code of the d-gram ending at the current position
+        size_t valid{};                           // letters since last break
+        for (auto r : seq) {
+            if (r < firstRank || r >= firstRank + letters) {
+                valid = 0;
+                continue;
+            }
+            valid += 1;
+            auto c = size_t(r - firstRank);
+            for (size_t d = std::min(valid, q); d > 1; --d) {
+                codes[d] = codes[d-1] * letters + c;
+            }
+            codes[1] = c;
+            for (size_t d{1}; d <= std::min(valid, q); ++d) {
+                seen[d][codes[d] / 64] |= uint64_t{1} << (codes[d] % 64);
+            }
+        }
+    }
+
+    auto stats() const -> QGramStats {
+        auto result = QGramStats{.letters = letters, .textLength = textLength, .occupancy = {1.}};
+        auto total = 1.;
+        for (size_t d{1}; d <= q; ++d) {
+            total *= letters;
+            size_t count{};
+            for (auto w : seen[d]) count += std::popcount(w);
+            result.occupancy.push_back(count / total);
+        }
+        return result;
+    }
+};
+
+namespace reference_model {
+
+/* Expected number of nodes of the search trees of an expanded scheme (one
+ * part per query position), each node weighted by the probability that its
+ * string occurs in the reference.
+ *
+ * States are (errors, depth offset), insertions consume a query position
+ * without extending the cursor, deletions extend the cursor without consuming
+ * a query position.
+ */
+template <bool Edit>
+auto weightedNodeCount(fmc::search_scheme::Scheme const& ss, QGramStats const& stats) -> long double {
+    auto sigma = (long double)stats.letters;
+    long double total{};
+    for (auto const& s : ss) {
+        auto len  = s.pi.size();
+        auto maxK = len ? s.u.back() : 0;
+        auto off  = maxK;            // offset of the depth difference
+        auto w    = 2*maxK+1;
+        auto state = std::vector<long double>((maxK+1) * w, 0.);
+        auto at = [&](auto& v, size_t e, size_t delta) -> long double& { return v[e*w + delta]; };
+        at(state, 0, off) = 1.;
+        for (size_t j{0}; j < len; ++j) {
+            if constexpr (Edit) {
+                // deletions before consuming position j
+                for (size_t e{0}; e < std::min<size_t>(maxK, s.u[j]); ++e) {
+                    for (size_t delta{0}; delta+1 < w; ++delta) {
+                        auto c = at(state, e, delta);
+                        if (c == 0.) continue;
+                        auto depth = j + delta + 1 - off;
+                        total += c * sigma * stats.weight(depth);
+                        at(state, e+1, delta+1) += c * sigma;
+                    }
+                }
+            }
+            auto next = std::vector<long double>(state.size(), 0.);
+            for (size_t e{0}; e <= maxK; ++e) {
+                for (size_t delta{0}; delta < w; ++delta) {
+                    auto c = at(state, e, delta);
+                    if (c == 0. || j + delta < off) continue;
+                    auto depth = j + delta + 1 - off;
+                    if (e >= s.l[j] && e <= s.u[j]) { // match
+                        total += c * stats.weight(depth);
+                        at(next, e, delta) += c;
+                    }
+                    if (e+1 >= s.l[j] && e+1 <= s.u[j]) {
+                        // substitution
+                        total += c * (sigma-1) * stats.weight(depth);
+                        at(next, e+1, delta) += c * (sigma-1);
+                        // insertion
+                        if (Edit && delta > 0) {
+                            at(next, e+1, delta-1) += c;
+                        }
+                    }
+                }
+            }
+            state = std::move(next);
+        }
+    }
+    return total;
+}
+
+/* Part sizes minimizing weightedNodeCount, found by moving single positions
+ * between parts, starting from the uniform expansion
+ */
+template <bool Edit>
+auto optimizeCounts(fmc::search_scheme::Scheme const& sss, size_t len, QGramStats const& stats) -> std::vector<size_t> {
+    if (sss.empty()) return {};
+    auto counts = fmc::search_scheme::expandCount(sss[0].pi.size(), len);
+    auto cost   = [&](std::vector<size_t> const& c) {
+        return weightedNodeCount<Edit>(fmc::search_scheme::expand(sss, c), stats);
+    };
+    auto best = cost(counts);
+    while (true) {
+        auto bestMove = counts;
+        auto improved = false;
+        for (size_t from{0}; from < counts.size(); ++from) {
+            if (counts[from] <= 1) continue;
+            for (size_t to{0}; to < counts.size(); ++to) {
+                if (to == from) continue;
+                auto c = counts;
+                c[from] -= 1;
+                c[to]   += 1;
+                if (auto v = cost(c); v < best) {
+                    best     = v;
+                    bestMove = c;
+                    improved = true;
+                }
+            }
+        }
+        if (!improved) return counts;
+        counts = bestMove;
+    }
+}
+
+template <bool Edit>
+auto expand(fmc::search_scheme::Scheme const& sss, size_t len, QGramStats const& stats) -> fmc::search_scheme::Scheme {
+    return fmc::search_scheme::expand(sss, optimizeCounts<Edit>(sss, len, stats));
+}
+
+}
@@ -0,0 +1,82 @@
+// SPDX-FileCopyrightText: 2006-2024, Knut Reinert & Freie Universität Berlin
+// SPDX-FileCopyrightText: 2016-2024, Knut Reinert & MPI für molekulare Genetik
+// SPDX-License-Identifier: BSD-3-Clause
+
+#pragma once
+
+#include "utils/error_fmt.h"
+
+#include <algorithm>
+#include <charconv>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/* Names of the references of an index, one per line in the order of their
+ * global ids. Written by `sahara index` next to the index as "<index>.names",
+ * the name is the first word of the fasta header.
+ */
+struct ReferenceNames {
+    std::vector<std::string> names;
+
+    static auto path(std::filesystem::path const& indexPath) -> std::filesystem::path {
+        return indexPath.string() + ".names";
+    }
+
+    static auto shortName(std::string_view id) -> std::string {
+        return std::string{id.substr(0, id.find_first_of(" \t"))};
+    }
+
+    static auto load(std::filesystem::path const& path) -> ReferenceNames {
+        auto result = ReferenceNames{};
+        auto ifs    = std::ifstream{path};
+        if (!ifs) {
+            throw error_fmt{"failed opening file {}", path};
+        }
+        for (std::string line; std::getline(ifs, line);) {
+            result.names.push_back(line);
+        }
+        return result;
+    }
+
+    // writes the names, or appends them to an existing file
+    void save(std::filesystem::path const& path, bool append) const {
+        auto ofs = std::ofstream{path, append ? std::ios::app : std::ios::trunc};
+        if (!ofs) {
+            throw error_fmt{"failed opening file {}", path};
+        }
+        for (auto const& name : names) {
+            ofs << name << '\n';
+        }
+    }
+
+    /* Global ids of a comma separated list of names or ids. Names are looked
+     * up first, entries without a matching name are read as ids.
+     */
+    auto resolve(std::string_view list) const -> std::vector<size_t> {
+        auto ids = std::unordered_map<std::string_view, size_t>{};
+        for (size_t i{0}; i < names.size(); ++i) {
+            ids.try_emplace(names[i], i);
+        }
+        auto result = std::vector<size_t>{};
+        while (!list.empty()) {
+            auto entry = list.substr(0, list.find(','));
+            list.remove_prefix(std::min(list.size(), entry.size() + 1));
+            if (entry.empty()) continue;
+            if (auto iter = ids.find(entry); iter != ids.end()) {
+                result.push_back(iter->second);
+                continue;
+            }
+            size_t id{};
+            auto [ptr, ec] = std::from_chars(entry.data(), entry.data() + entry.size(), id);
+            if (ec != std::errc{} || ptr != entry.data() + entry.size()) {
+                throw error_fmt{"unknown reference '{}'{}", entry, names.empty() ? " (the index has no reference names, use ids)" : ""};
+            }
+            result.push_back(id);
+        }
+        return result;
+    }
+};
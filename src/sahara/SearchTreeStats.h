@@ -0,0 +1,147 @@
+// SPDX-FileCopyrightText: 2006-2024, Knut Reinert & Freie Universität Berlin
+// SPDX-FileCopyrightText: 2016-2024, Knut Reinert & MPI für molekulare Genetik
+// SPDX-License-Identifier: BSD-3-Clause
+
+#pragma once
+
+#include <cstdint>
+#include <fmindex-collection/fmindex-collection.h>
+#include <fmt/format.h>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace search_tree_stats {
+// rank queries of the calling thread, only counted by indices using CountingString
+inline thread_local size_t rankCalls{};
+// rank queries for all symbols at once, two of them are needed to expand a node of the search tree
+inline thread_local size_t allRankCalls{};
+}
+
+/* Bwt string, which counts every rank query
+ *
+ * Has the same memory layout and serialization as InterleavedBitvector16, so
+ * it can load normal index files. Only used when search tree statistics are
+ * requested, such that normal searches stay free of the counting overhead.
+ */
+template <size_t Sigma>
+struct CountingString : fmc::string::InterleavedBitvector16<Sigma> {
+    using Base = fmc::string::InterleavedBitvector16<Sigma>;
+    using Base::Base;
+
+    template <typename... Args>
+    auto rank(Args&&... args) const {
+        search_tree_stats::rankCalls += 1;
+        return Base::rank(std::forward<Args>(args)...);
+    }
+
+    template <typename... Args>
+    auto prefix_rank(Args&&... args) const {
+        search_tree_stats::rankCalls += 1;
+        return Base::prefix_rank(std::forward<Args>(args)...);
+    }
+
+    template <typename... Args>
+    auto all_ranks(Args&&... args) const {
+        search_tree_stats::rankCalls    += 1;
+        search_tree_stats::allRankCalls += 1;
+        return Base::all_ranks(std::forward<Args>(args)...);
+    }
+
+    template <typename... Args>
+    auto all_ranks_and_prefix_ranks(Args&&... args) const {
+        search_tree_stats::rankCalls    += 1;
+        search_tree_stats::allRankCalls += 1;
+        return Base::all_ranks_and_prefix_ranks(std::forward<Args>(args)...);
+    }
+};
+
+/* Measured search tree sizes, aggregated per search of a search scheme,
+ * per error level and per query length bucket.
+ *
+ * A node is counted as expanded, when the engine extends its cursor by all
+ * symbols (two rank queries for all symbols). The predicted weighted node
+ * count instead counts all nodes of the tree, each expansion creating up to
+ * sigma-1 of them, both are reported per query.
+ */
+struct SearchTreeStats {
+    static constexpr size_t BucketWidth = 50;
+
+    struct Counts {
+        size_t queries{};
+        size_t expandedNodes{};
+        size_t rankCalls{};
+
+        void add(Counts const& other) {
+            queries       += other.queries;
+            expandedNodes += other.expandedNodes;
+            rankCalls     += other.rankCalls;
+        }
+    };
+
+    struct Search {
+        std::string label;     // e.g. "level 1 search 2"
+        size_t      minErrors;
+        size_t      maxErrors;
+        double      predicted; // weighted node count of this search
+        Counts      measured;
+    };
+
+    std::vector<Search>      searches;
+    std::map<size_t, Counts> buckets;  // first length of the bucket -> counts
+    std::map<size_t, Counts> levels;   // maximum errors of a search -> counts
+
+    size_t searchRankCalls{};
+    size_t locateRankCalls{};
+    size_t locateRows{};
+
+    // snapshot of the counters of the calling thread
+    static auto snapshot() -> Counts {
+        return {0, search_tree_stats::allRankCalls / 2, search_tree_stats::rankCalls};
+    }
+
+    static auto delta(Counts const& before) -> Counts {
+        auto now = snapshot();
+        return {1, now.expandedNodes - before.expandedNodes, now.rankCalls - before.rankCalls};
+    }
+
+    // merges stats of another shard, searches must be in the same order
+    void add(SearchTreeStats const& other) {
+        if (searches.empty()) {
+            searches = other.searches;
+        } else {
+            for (size_t i{0}; i < searches.size(); ++i) {
+                searches[i].measured.add(other.searches[i].measured);
+            }
+        }
+        for (auto const& [key, c] : other.buckets) buckets[key].add(c);
+        for (auto const& [key, c] : other.levels)  levels[key].add(c);
+        searchRankCalls += other.searchRankCalls;
+        locateRankCalls += other.locateRankCalls;
+        locateRows      += other.locateRows;
+    }
+
+    void print() const {
+        auto perQuery = [](size_t v, size_t queries) {
+            return queries?double(v) / queries:0.;
+        };
+        fmt::print("search tree (per query):\n");
+        fmt::print("  {:<20} {:>6} {:>16} {:>16} {:>16}\n", "search", "errors", "predicted nodes", "expanded nodes", "rank calls");
+        for (auto const& s : searches) {
+            fmt::print("  {:<20} {:>6} {:>16.1f} {:>16.1f} {:>16.1f}\n", s.label, fmt::format("{}-{}", s.minErrors, s.maxErrors),
+                       s.predicted, perQuery(s.measured.expandedNodes, s.measured.queries), perQuery(s.measured.rankCalls, s.measured.queries));
+        }
+        for (auto const& [level, c] : levels) {
+            fmt::print("  {:<20} {:>6} {:>16} {:>16.1f} {:>16.1f}\n", fmt::format("max errors {}", level), "", "",
+                       perQuery(c.expandedNodes, c.queries), perQuery(c.rankCalls, c.queries));
+        }
+        for (auto const& [start, c] : buckets) {
+            fmt::print("  {:<20} {:>6} {:>16} {:>16.1f} {:>16.1f}\n", fmt::format("length {}-{}", start, start+BucketWidth-1), "", "",
+                       perQuery(c.expandedNodes, c.queries), perQuery(c.rankCalls, c.queries));
+        }
+        fmt::print("  search rank calls:   {:>10}\n", searchRankCalls);
+        fmt::print("  locate rows:         {:>10}\n", locateRows);
+        fmt::print("  locate rank calls:   {:>10}\n", locateRankCalls);
+    }
+};
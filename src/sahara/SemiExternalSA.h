@@ -0,0 +1,130 @@
+// SPDX-FileCopyrightText: 2006-2024, Knut Reinert & Freie Universität Berlin
+// SPDX-FileCopyrightText: 2016-2024, Knut Reinert & MPI für molekulare Genetik
+// SPDX-License-Identifier: BSD-3-Clause
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace semi_external_sa {
+
+struct Entry {
+    uint64_t key; // next 8 characters, big endian, zero padded
+    int64_t  pos;
+};
+
+inline auto loadKey(std::span<uint8_t const> text, size_t pos) -> uint64_t {
+    uint64_t key{};
+    for (size_t i{0}; i < 8; ++i) {
+        key = (key << 8) | (pos + i < text.size()?text[pos+i]:0);
+    }
+    return key;
+}
+
+// Compares two suffixes, which share the first `offset` characters
+inline bool lessSuffix(std::span<uint8_t const> text, size_t lhs, size_t rhs, size_t offset) {
+    lhs += offset;
+    rhs += offset;
+    while (lhs < text.size() && rhs < text.size()) {
+        if (text[lhs] != text[rhs]) return text[lhs] < text[rhs];
+        ++lhs;
+        ++rhs;
+    }
+    return lhs == text.size() && rhs != text.size();
+}
+
+}
+
+/* Semi external suffix array construction
+ *
+ * The text has to be accessible (in memory or memory mapped), but the suffix
+ * array is never held completely in memory. Suffixes are partitioned into
+ * buckets by their first q characters, such that each bucket fits into the
+ * given memory budget. Each bucket is collected by a scan over the text, sorted
+ * and reported in lexicographical order through the callback
+ * `cb(std::span<int64_t const>)`.
+ *
+ * As with libsais, the end of the text is considered smaller than any
+ * character, such that no terminal character is required. Memory usage is
+ * roughly 24 bytes per suffix of the largest bucket plus the q-gram count
+ * table, time is one scan over the text per bucket.
+ */
+template <typename CB>
+void createSASemiExternal(std::span<uint8_t const> text, size_t ramBudget, CB&& cb) {
+    using namespace semi_external_sa;
+
+    // map characters to dense ranks, 0 is reserved for padding behind the text
+    auto rank = std::array<uint64_t, 256>{};
+    for (auto c : text) {
+        rank[c] = 1;
+    }
+    uint64_t sigma = 1;
+    for (auto& r : rank) {
+        if (r) r = sigma++;
+    }
+
+    // choose q such that the count table stays small compared to the budget
+    size_t q{1};
+    uint64_t buckets{sigma};
+    while (q < 12 && buckets * sigma * sizeof(size_t) * 16 <= ramBudget && buckets * sigma <= (uint64_t{1} << 28)) {
+        buckets *= sigma;
+        q += 1;
+    }
+    auto const highest = buckets / sigma; // weight of the first character
+
+    // iterates over the q-gram code of every suffix
+    auto forEachCode = [&](auto&& f) {
+        uint64_t code{};
+        for (size_t i{0}; i+1 < q; ++i) {
+            code = code * sigma + (i < text.size()?rank[text[i]]:0);
+        }
+        for (size_t i{0}; i < text.size(); ++i) {
+            auto j = i + q - 1;
+            code = (code % highest) * sigma + (j < text.size()?rank[text[j]]:0);
+            f(i, code);
+        }
+    };
+
+    auto counts = std::vector<size_t>(buckets, 0);
+    forEachCode([&](size_t, uint64_t code) {
+        counts[code] += 1;
+    });
+
+    // every suffix of a bucket group is held as an entry and as a position of the reported array
+    auto const maxEntries = std::max(size_t{1}, ramBudget / (sizeof(Entry) + sizeof(int64_t)));
+    auto entries = std::vector<Entry>{};
+    auto sa      = std::vector<int64_t>{};
+
+    for (uint64_t begin{0}; begin < buckets;) {
+        // largest range of q-grams that fits into the budget (at least one q-gram)
+        size_t total = counts[begin];
+        auto end = begin+1;
+        while (end < buckets && total + counts[end] <= maxEntries) {
+            total += counts[end];
+            ++end;
+        }
+        if (total > 0) {
+            entries.clear();
+            entries.reserve(total);
+            forEachCode([&](size_t i, uint64_t code) {
+                if (code >= begin && code < end) {
+                    entries.push_back({loadKey(text, i), int64_t(i)});
+                }
+            });
+            std::ranges::sort(entries, [&](Entry const& lhs, Entry const& rhs) {
+                if (lhs.key != rhs.key) return lhs.key < rhs.key;
+                return lessSuffix(text, lhs.pos, rhs.pos, 8);
+            });
+            sa.resize(entries.size());
+            for (size_t i{0}; i < entries.size(); ++i) {
+                sa[i] = entries[i].pos;
+            }
+            cb(std::span<int64_t const>{sa});
+        }
+        begin = end;
+    }
+}
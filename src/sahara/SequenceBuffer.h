@@ -0,0 +1,175 @@
+// SPDX-FileCopyrightText: 2006-2024, Knut Reinert & Freie Universität Berlin
+// SPDX-FileCopyrightText: 2016-2024, Knut Reinert & MPI für molekulare Genetik
+// SPDX-License-Identifier: BSD-3-Clause
+
+#pragma once
+
+#include "utils/error_fmt.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <ivsigma/ivsigma.h>
+#include <span>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+/* Stores the ranks (or characters) of many sequences (references or queries)
+ * consecutively in one buffer plus an offset array, instead of one vector per
+ * sequence.
+ *
+ * Without a scratch directory the buffer lives on the heap (grown with realloc,
+ * which for large blocks remaps pages instead of copying). With a scratch
+ * directory the buffer is a memory mapped file, which the kernel can page out
+ * while the index is being constructed.
+ */
+struct SequenceBuffer {
+private:
+    uint8_t* buffer{};
+    size_t   bufferSize{};
+    size_t   capacity{};
+    std::vector<size_t> ends; // end offset of each sequence inside the buffer
+    int      fd{-1};          // file descriptor of the scratch file
+    size_t   allocationCount{};
+
+    void reserve(size_t newCapacity) {
+        if (newCapacity <= capacity) return;
+        newCapacity = std::max({newCapacity, capacity * 2, size_t{1} << 24});
+
+        if (fd == -1) {
+            auto ptr = static_cast<uint8_t*>(std::realloc(buffer, newCapacity));
+            if (!ptr) {
+                throw error_fmt{"failed allocating {} bytes for the sequence buffer", newCapacity};
+            }
+            buffer = ptr;
+        } else {
+            if (ftruncate(fd, newCapacity) != 0) {
+                throw error_fmt{"failed resizing scratch file to {} bytes: {}", newCapacity, std::strerror(errno)};
+            }
+            void* ptr = buffer?mremap(buffer, capacity, newCapacity, MREMAP_MAYMOVE)
+                              :mmap(nullptr, newCapacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (ptr == MAP_FAILED) {
+                throw error_fmt{"failed mapping scratch file with {} bytes: {}", newCapacity, std::strerror(errno)};
+            }
+            buffer = static_cast<uint8_t*>(ptr);
+        }
+        capacity = newCapacity;
+        allocationCount += 1;
+    }
+
+public:
+    SequenceBuffer() = default;
+
+    // the buffer is backed by an (already deleted) file inside scratchDir
+    explicit SequenceBuffer(std::filesystem::path const& scratchDir) {
+        if (scratchDir.empty()) return;
+        auto name = (scratchDir / "sahara-refs-XXXXXX").string();
+        fd = mkstemp(name.data());
+        if (fd == -1) {
+            throw error_fmt{"failed creating scratch file in {}: {}", scratchDir, std::strerror(errno)};
+        }
+        unlink(name.c_str());
+    }
+
+    SequenceBuffer(SequenceBuffer const&) = delete;
+    auto operator=(SequenceBuffer const&) -> SequenceBuffer& = delete;
+
+    ~SequenceBuffer() {
+        release();
+        if (fd != -1) {
+            close(fd);
+        }
+    }
+
+    // appends a new sequence of length len, returns the memory it has to be written to
+    auto append(size_t len) -> std::span<uint8_t> {
+        reserve(bufferSize + len);
+        auto r = std::span<uint8_t>{buffer + bufferSize, len};
+        bufferSize += len;
+        ends.push_back(bufferSize);
+        return r;
+    }
+
+    // number of sequences
+    auto size() const -> size_t {
+        return ends.size();
+    }
+
+    auto empty() const -> bool {
+        return ends.empty();
+    }
+
+    // total length of all sequences
+    auto totalSize() const -> size_t {
+        return bufferSize;
+    }
+
+    auto operator[](size_t i) const -> std::span<uint8_t const> {
+        auto start = i==0?0:ends[i-1];
+        return {buffer + start, ends[i] - start};
+    }
+
+    // all sequences concatenated
+    auto text() -> std::span<uint8_t> {
+        return {buffer, bufferSize};
+    }
+
+    auto back() -> std::span<uint8_t> {
+        auto start = ends.size()<2?0:ends[ends.size()-2];
+        return {buffer + start, ends.back() - start};
+    }
+
+    // number of times the buffer had to be (re)allocated
+    auto allocations() const -> size_t {
+        return allocationCount;
+    }
+
+    // keeps only the first n sequences
+    void truncate(size_t n) {
+        if (n >= ends.size()) return;
+        ends.resize(n);
+        bufferSize = ends.empty()?0:ends.back();
+    }
+
+    // views onto all sequences, valid until the next call to append or release
+    auto sequences() const -> std::vector<std::span<uint8_t const>> {
+        auto r = std::vector<std::span<uint8_t const>>{};
+        r.reserve(size());
+        for (size_t i{0}; i < size(); ++i) {
+            r.emplace_back((*this)[i]);
+        }
+        return r;
+    }
+
+    // removes all sequences and gives the memory back to the system
+    void release() {
+        if (buffer) {
+            if (fd == -1) {
+                std::free(buffer);
+            } else {
+                munmap(buffer, capacity);
+                [[maybe_unused]] auto e = ftruncate(fd, 0);
+            }
+        }
+        buffer     = nullptr;
+        bufferSize = 0;
+        capacity   = 0;
+        ends       = {};
+    }
+};
+
+// appends the reverse complement of the last sequence
+template <typename Alphabet>
+void appendReverseComplement(SequenceBuffer& buffer) {
+    auto len = buffer.back().size();
+    auto rev = buffer.append(len);
+    auto fwd = buffer[buffer.size()-2]; // must be fetched after append, the buffer might have moved
+    for (size_t i{0}; i < len; ++i) {
+        rev[i] = ivs::complement_rank<Alphabet>(fwd[len-1-i]);
+    }
+}
@@ -0,0 +1,86 @@
+// SPDX-FileCopyrightText: 2006-2024, Knut Reinert & Freie Universität Berlin
+// SPDX-FileCopyrightText: 2016-2024, Knut Reinert & MPI für molekulare Genetik
+// SPDX-License-Identifier: BSD-3-Clause
+
+#pragma once
+
+#include "utils/DecompressStream.h"
+
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <ivio/ivio.h>
+#include <memory>
+
+/* Wraps an ivio reader (e.g. ivio::fasta::reader), such that gzip and bgzf
+ * compressed files are accepted as well. Compression is detected by the magic
+ * bytes of the file, compressed files are decompressed by a DecompressStream
+ * ahead of the parser, uncompressed files are handed to ivio directly.
+ */
+template <typename Reader = ivio::fasta::reader>
+struct SequenceReader {
+private:
+    std::unique_ptr<DecompressStream> stream;
+    Reader reader;
+
+    static auto openStream(std::filesystem::path const& path, size_t threadNbr) -> std::unique_ptr<DecompressStream> {
+        auto compression = detectCompression(path);
+        if (compression == Compression::None) {
+            return nullptr;
+        }
+        return std::make_unique<DecompressStream>(path, compression, threadNbr);
+    }
+
+    static auto makeConfig(std::filesystem::path const& path, DecompressStream* stream) -> typename Reader::config {
+        if (stream) {
+            return {.input = std::ref<std::istream>(*stream)};
+        }
+        return {.input = path};
+    }
+
+public:
+    explicit SequenceReader(std::filesystem::path const& path, size_t threadNbr = defaultDecompressThreads())
+        : stream{openStream(path, threadNbr)}
+        , reader{makeConfig(path, stream.get())}
+    {}
+
+    auto begin() {
+        return reader.begin();
+    }
+
+    auto end() {
+        return reader.end();
+    }
+};
+
+// checks if a (possibly compressed) file is a fastq file, by looking at its first character
+inline auto isFastqFile(std::filesystem::path const& path) -> bool {
+    auto first = [](std::istream& is) {
+        char c{};
+        is >> c; // skips leading whitespaces
+        return c;
+    };
+    if (auto compression = detectCompression(path); compression != Compression::None) {
+        auto stream = DecompressStream{path, compression, 1};
+        return first(stream) == '@';
+    }
+    auto ifs = std::ifstream{path, std::ios::binary};
+    return first(ifs) == '@';
+}
+
+/* Calls cb(record) for every record of a fasta or fastq file (possibly
+ * compressed). The record provides `id` and `seq` as views into the buffer of
+ * the parser, they are only valid during the call.
+ */
+template <typename CB>
+void forEachSequenceRecord(std::filesystem::path const& path, CB&& cb) {
+    if (isFastqFile(path)) {
+        for (auto record : SequenceReader<ivio::fastq::reader>{path}) {
+            cb(record);
+        }
+    } else {
+        for (auto record : SequenceReader<ivio::fasta::reader>{path}) {
+            cb(record);
+        }
+    }
+}
@@ -0,0 +1,102 @@
+// SPDX-FileCopyrightText: 2006-2024, Knut Reinert & Freie Universität Berlin
+// SPDX-FileCopyrightText: 2016-2024, Knut Reinert & MPI für molekulare Genetik
+// SPDX-License-Identifier: BSD-3-Clause
+
+#pragma once
+
+#include "utils/Json.h"
+#include "utils/error_fmt.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <vector>
+
+/* Fastest search scheme configuration per (errors, query length, metric),
+ * measured by `sahara tune` on a specific index.
+ *
+ * The profile is stored next to the index as "<index>.tune.json" and picked
+ * up by `sahara search` if no generator is given explicitly.
+ */
+struct TuningProfile {
+    struct Entry {
+        size_t      errors{};
+        size_t      length{};
+        std::string metric;     // "ham" or "lev"
+        std::string generator;
+        bool        dynamic{};  // expanded with expandByWNCTopDown instead of expand
+        double      seconds{};  // search time per query
+        double      nodes{};    // expanded nodes per query
+    };
+
+    std::vector<Entry> entries;
+
+    static auto path(std::filesystem::path const& indexPath) -> std::filesystem::path {
+        return indexPath.string() + ".tune.json";
+    }
+
+    // loads a profile, returns an empty profile if the file does not exist
+    static auto load(std::filesystem::path const& path) -> TuningProfile {
+        auto profile = TuningProfile{};
+        if (!std::filesystem::exists(path)) {
+            return profile;
+        }
+        auto json = JsonValue::load(path);
+        auto list = json.find("entries");
+        if (!list) {
+            throw error_fmt{"{} is not a tuning profile", path};
+        }
+        for (auto const& e : list->array) {
+            profile.entries.push_back({
+                .errors    = size_t(e.find("errors")->number),
+                .length    = size_t(e.find("length")->number),
+                .metric    = e.find("metric")->string,
+                .generator = e.find("generator")->string,
+                .dynamic   = e.find("dynamic")->boolean,
+                .seconds   = e.find("seconds")->number,
+                .nodes     = e.find("nodes")->number,
+            });
+        }
+        return profile;
+    }
+
+    void save(std::filesystem::path const& path) const {
+        auto ofs = fopen(path.c_str(), "w");
+        if (!ofs) {
+            throw error_fmt{"failed opening file {}", path};
+        }
+        fmt::print(ofs, "{{\n  \"entries\": [");
+        for (size_t i{0}; i < entries.size(); ++i) {
+            auto const& e = entries[i];
+            fmt::print(ofs, "{}\n    {{\"errors\": {}, \"length\": {}, \"metric\": \"{}\", \"generator\": \"{}\", \"dynamic\": {}, \"seconds\": {}, \"nodes\": {}}}",
+                       i?",":"", e.errors, e.length, jsonEscape(e.metric), jsonEscape(e.generator), e.dynamic, e.seconds, e.nodes);
+        }
+        fmt::print(ofs, "\n  ]\n}}\n");
+        fclose(ofs);
+    }
+
+    // adds an entry, replacing an entry with the same errors, length and metric
+    void set(Entry entry) {
+        for (auto& e : entries) {
+            if (e.errors == entry.errors && e.length == entry.length && e.metric == entry.metric) {
+                e = std::move(entry);
+                return;
+            }
+        }
+        entries.push_back(std::move(entry));
+    }
+
+    // entry for the given errors and metric with the closest query length
+    auto find(size_t errors, size_t length, std::string const& metric) const -> std::optional<Entry> {
+        auto best = std::optional<Entry>{};
+        for (auto const& e : entries) {
+            if (e.errors != errors || e.metric != metric) continue;
+            auto dist = [&](size_t l) { return l > length ? l - length : length - l; };
+            if (!best || dist(e.length) < dist(best->length)) {
+                best = e;
+            }
+        }
+        return best;
+    }
+};
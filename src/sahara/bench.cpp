@@ -0,0 +1,483 @@
+// SPDX-FileCopyrightText: 2006-2024, Knut Reinert & Freie Universität Berlin
+// SPDX-FileCopyrightText: 2016-2024, Knut Reinert & MPI für molekulare Genetik
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include "ReadSimulator.h"
+#include "utils/Json.h"
+#include "utils/StopWatch.h"
+#include "utils/error_fmt.h"
+
+#include <algorithm>
+#include <array>
+#include <clice/clice.h>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <ivio/ivio.h>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+/* sahara-bench - reproducible benchmarks of all index and search subcommands
+ *
+ * Generates a random reference and simulated reads with fixed seeds, runs
+ * every index construction and search configuration through the sahara
+ * binary and collects the numbers of their stats blocks into a json file.
+ */
+
+namespace {
+auto cliSahara = clice::Argument {
+    .args   = "--sahara",
+    .desc   = "path to the sahara binary (default: sahara next to sahara-bench)",
+    .value  = std::filesystem::path{},
+};
+
+auto cliWorkDir = clice::Argument {
+    .args   = "--work_dir",
+    .desc   = "directory for the generated references, reads and indices",
+    .value  = std::filesystem::path{"sahara-bench-data"},
+};
+
+auto cliOutput = clice::Argument {
+    .args   = {"-o", "--output"},
+    .desc   = "path of the json file with all results",
+    .value  = std::filesystem::path{"sahara-bench.json"},
+};
+
+auto cliReferenceLength = clice::Argument {
+    .args   = "--reference_length",
+    .desc   = "total number of bases of the generated reference",
+    .value  = size_t{10'000'000},
+};
+
+auto cliReferences = clice::Argument {
+    .args   = "--references",
+    .desc   = "number of records the reference is split into",
+    .value  = size_t{4},
+};
+
+auto cliReads = clice::Argument {
+    .args   = {"-n", "--number_of_reads"},
+    .desc   = "number of simulated reads per error count",
+    .value  = size_t{10'000},
+};
+
+auto cliReadLength = clice::Argument {
+    .args   = {"-l", "--read_length"},
+    .desc   = "length of the simulated reads",
+    .value  = size_t{150},
+};
+
+auto cliMaxErrors = clice::Argument {
+    .args   = {"-e", "--max_errors"},
+    .desc   = "searches are run for every error count from 0 up to this value",
+    .value  = size_t{4},
+};
+
+auto cliSeed = clice::Argument {
+    .args   = "--seed",
+    .desc   = "seed of the reference and read generation",
+    .value  = uint64_t{0},
+};
+
+auto cliRepeats = clice::Argument {
+    .args   = "--repeats",
+    .desc   = "number of runs of every benchmark",
+    .value  = size_t{1},
+};
+
+auto cliFilter = clice::Argument {
+    .args   = "--filter",
+    .desc   = "only run benchmarks whose name contains this string",
+    .value  = std::string{},
+};
+
+auto cliBaseline = clice::Argument {
+    .args   = "--baseline",
+    .desc   = "compare the results with this earlier result file, fails if a metric got worse than the tolerance",
+    .value  = std::filesystem::path{},
+};
+
+auto cliCompareOnly = clice::Argument {
+    .args   = "--compare_only",
+    .desc   = "do not run any benchmark, compare the existing --output file with --baseline",
+};
+
+auto cliTimeTolerance = clice::Argument {
+    .args   = "--time_tolerance",
+    .desc   = "allowed slow down of times and throughput in percent",
+    .value  = 10.,
+};
+
+auto cliMemoryTolerance = clice::Argument {
+    .args   = "--memory_tolerance",
+    .desc   = "allowed increase of the peak memory in percent",
+    .value  = 10.,
+};
+
+struct Benchmark {
+    std::string              name;
+    std::vector<std::string> args;
+};
+
+struct Run {
+    std::string                   name;
+    std::string                   command;
+    size_t                        repeat;
+    double                        wallTime;
+    std::map<std::string, double> metrics;
+};
+
+auto shellQuote(std::string const& s) -> std::string {
+    auto r = std::string{"'"};
+    for (auto c : s) {
+        if (c == '\'') r += "'\\''";
+        else           r += c;
+    }
+    return r + "'";
+}
+
+/* Parses the "stats:" block of a subcommand. Each line "  key: value..."
+ * becomes a metric, only the leading number of the value is used.
+ */
+auto parseStats(std::string const& output) -> std::map<std::string, double> {
+    auto metrics = std::map<std::string, double>{};
+    bool inStats{false};
+    size_t pos{};
+    while (pos < output.size()) {
+        auto end  = std::min(output.find('\n', pos), output.size());
+        auto line = std::string_view{output}.substr(pos, end - pos);
+        pos = end + 1;
+        if (line == "stats:") {
+            inStats = true;
+            continue;
+        }
+        if (!inStats) continue;
+        if (!line.starts_with("  ")) {
+            inStats = false;
+            continue;
+        }
+        auto colon = line.find(':');
+        if (colon == std::string_view::npos) continue;
+        auto key   = std::string{line.substr(2, colon-2)};
+        auto value = std::string{line.substr(colon+1)};
+        char* valueEnd{};
+        auto v = std::strtod(value.c_str(), &valueEnd);
+        if (valueEnd != value.c_str()) {
+            metrics[key] = v;
+        }
+    }
+    return metrics;
+}
+
+auto runCommand(std::string const& command) -> std::string {
+    auto pipe = popen((command + " 2>&1").c_str(), "r");
+    if (!pipe) {
+        throw error_fmt{"failed running {}", command};
+    }
+    auto output = std::string{};
+    auto buffer = std::array<char, 4096>{};
+    while (auto n = fread(buffer.data(), 1, buffer.size(), pipe)) {
+        output.append(buffer.data(), n);
+    }
+    auto status = pclose(pipe);
+    if (status != 0) {
+        throw error_fmt{"command failed ({}): {}\n{}", status, command, output};
+    }
+    return output;
+}
+
+// writes a random reference, split into `references` records
+void generateReference(std::filesystem::path const& path, std::mt19937_64& generator) {
+    auto writer  = ivio::fasta::writer{{.output = path}};
+    auto dist    = std::uniform_int_distribution<size_t>{0, 3};
+    auto records = std::max(size_t{1}, *cliReferences);
+    for (size_t i{0}; i < records; ++i) {
+        auto seq = std::string(*cliReferenceLength / records, 'A');
+        for (auto& c : seq) {
+            c = "ACGT"[dist(generator)];
+        }
+        writer.write({
+            .id  = fmt::format("ref-{}", i),
+            .seq = seq,
+        });
+    }
+}
+
+// writes reads with exactly `errors` random substitutions, insertions or deletions
+void generateReads(std::filesystem::path const& path, std::vector<std::string> const& sequences, size_t errors, uint64_t seed) {
+    auto readGenerator = ReadGenerator { .sequences  = sequences,
+                                         .readLength = *cliReadLength,
+                                         .generator  = std::mt19937_64{seed} };
+    auto generator = std::mt19937_64{seed + 1};
+    auto pickError = std::uniform_int_distribution<size_t>{0, 2};
+
+    auto writer = ivio::fasta::writer{{.output = path}};
+    for (size_t i{0}; i < *cliReads; ++i) {
+        auto error = std::array<size_t, 3>{};
+        for (size_t j{0}; j < errors; ++j) {
+            error[pickError(generator)] += 1;
+        }
+        auto transcript = Transcript{generator, *cliReadLength, error[0], error[1], error[2]};
+        auto [seqId, pos, read] = readGenerator.generate(transcript.lengthOfRef());
+        writer.write({
+            .id  = fmt::format("simulated-{} (seqid:{}, pos:{}, trans:{})", i, seqId, pos, transcript.transcript),
+            .seq = readGenerator.applyTranscript(read, transcript.transcript),
+        });
+    }
+}
+
+auto benchmarks(std::filesystem::path const& dir) -> std::vector<Benchmark> {
+    auto ref    = (dir / "ref.fasta").string();
+    auto reads  = [&](size_t e) { return (dir / fmt::format("reads-e{}.fasta", e)).string(); };
+    auto output = (dir / "output.txt").string();
+
+    auto list = std::vector<Benchmark>{
+        {"index/bi",   {"index", ref}},
+        {"index/uni",  {"uni-index", ref}},
+        {"index/rbi",  {"rbi-index", ref}},
+        {"index/kmer", {"kmer-index", ref}},
+    };
+    for (auto mode : {"all", "besthits"}) {
+        for (auto metric : {"ham", "lev"}) {
+            for (size_t e{0}; e <= *cliMaxErrors; ++e) {
+                list.push_back({fmt::format("search/bi/{}/{}/e{}", mode, metric, e),
+                               {"search", "-i", ref + ".idx", "-q", reads(e), "-e", std::to_string(e), "-m", mode, "-d", metric, "-o", output}});
+            }
+        }
+        for (size_t e{0}; e <= *cliMaxErrors; ++e) {
+            list.push_back({fmt::format("search/rbi/{}/lev/e{}", mode, e),
+                           {"rbi-search", "-i", ref + ".rbi.idx", "-q", reads(e), "-e", std::to_string(e), "-m", mode, "-o", output}});
+        }
+    }
+    // the same workload with every engine of `search --engine`, side by side
+    for (auto mode : {"all", "besthits"}) {
+        for (auto engine : {"ng24", "ng21", "pseudo", "backtracking"}) {
+            for (size_t e{0}; e <= *cliMaxErrors; ++e) {
+                list.push_back({fmt::format("search/engine/{}/{}/lev/e{}", engine, mode, e),
+                               {"search", "-i", ref + ".idx", "-q", reads(e), "-e", std::to_string(e), "-m", mode, "-d", "lev", "--engine", engine, "-o", output}});
+            }
+        }
+    }
+    list.push_back({"search/uni/exact/e0", {"uni-search", "-i", ref + ".single.idx", "-q", reads(0), "-o", output}});
+    for (size_t e{0}; e <= *cliMaxErrors; ++e) {
+        list.push_back({fmt::format("search/kmer/e{}", e), {"kmer-search", "--index", ref + ".kmer.idx", "--query", reads(e), "--output", output}});
+    }
+    return list;
+}
+
+void writeResults(std::filesystem::path const& path, std::vector<Run> const& runs) {
+    auto ofs = fopen(path.c_str(), "w");
+    if (!ofs) {
+        throw error_fmt{"failed opening file {}", path};
+    }
+    fmt::print(ofs, "{{\n  \"seed\": {},\n  \"reference_length\": {},\n  \"references\": {},\n  \"reads\": {},\n  \"read_length\": {},\n  \"results\": [",
+               *cliSeed, *cliReferenceLength, *cliReferences, *cliReads, *cliReadLength);
+    for (size_t i{0}; i < runs.size(); ++i) {
+        auto const& r = runs[i];
+        fmt::print(ofs, "{}\n    {{\"name\": \"{}\", \"repeat\": {}, \"command\": \"{}\", \"wall_seconds\": {}, \"metrics\": {{",
+                   i?",":"", jsonEscape(r.name), r.repeat, jsonEscape(r.command), r.wallTime);
+        bool first{true};
+        for (auto const& [key, value] : r.metrics) {
+            fmt::print(ofs, "{}\"{}\": {}", first?"":", ", jsonEscape(key), value);
+            first = false;
+        }
+        fmt::print(ofs, "}}}}");
+    }
+    fmt::print(ofs, "\n  ]\n}}\n");
+    fclose(ofs);
+}
+
+auto loadResults(std::filesystem::path const& path) -> std::vector<Run> {
+    auto json    = JsonValue::load(path);
+    auto results = json.find("results");
+    if (!results) {
+        throw error_fmt{"{} is not a sahara-bench result file", path};
+    }
+    auto runs = std::vector<Run>{};
+    for (auto const& r : results->array) {
+        auto run = Run{r.find("name")->string, r.find("command")->string, size_t(r.find("repeat")->number), r.find("wall_seconds")->number, {}};
+        for (auto const& [key, value] : r.find("metrics")->object) {
+            run.metrics[key] = value.number;
+        }
+        runs.push_back(std::move(run));
+    }
+    return runs;
+}
+
+auto median(std::vector<double> values) -> double {
+    std::ranges::sort(values);
+    auto n = values.size();
+    if (n == 0) return 0.;
+    return n % 2 ? values[n/2] : (values[n/2-1] + values[n/2]) / 2.;
+}
+
+// median absolute deviation, scaled to be comparable to a standard deviation
+auto mad(std::vector<double> const& values) -> double {
+    auto m = median(values);
+    auto deviations = std::vector<double>{};
+    for (auto v : values) {
+        deviations.push_back(std::abs(v - m));
+    }
+    return 1.4826 * median(deviations);
+}
+
+/* Compares the medians of all repeats per benchmark and metric. A metric
+ * regresses if it got worse by more than its tolerance and, if there are
+ * repeats, the difference is larger than three times the noise (MAD).
+ * Returns the number of regressions.
+ */
+auto compareResults(std::vector<Run> const& baseline, std::vector<Run> const& current) -> size_t {
+    enum class Better { Lower, Higher };
+    struct Metric {
+        char const* name;
+        Better      better;
+        double      tolerance; // relative
+    };
+    auto metrics = std::array<Metric, 6>{{
+        {"wall_seconds",       Better::Lower,  *cliTimeTolerance / 100.},
+        {"total time",         Better::Lower,  *cliTimeTolerance / 100.},
+        {"search time",        Better::Lower,  *cliTimeTolerance / 100.},
+        {"locate time",        Better::Lower,  *cliTimeTolerance / 100.},
+        {"queries per second", Better::Higher, *cliTimeTolerance / 100.},
+        {"peak memory",        Better::Lower,  *cliMemoryTolerance / 100.},
+    }};
+
+    // name -> metric -> values of all repeats
+    using Values = std::map<std::string, std::map<std::string, std::vector<double>>>;
+    auto collect = [](std::vector<Run> const& runs) {
+        auto values = Values{};
+        for (auto const& r : runs) {
+            values[r.name]["wall_seconds"].push_back(r.wallTime);
+            for (auto const& [key, v] : r.metrics) {
+                values[r.name][key].push_back(v);
+            }
+        }
+        return values;
+    };
+    auto base = collect(baseline);
+    auto cur  = collect(current);
+
+    size_t regressions{};
+    fmt::print("{:<30} {:<20} {:>12} {:>12} {:>9}  {}\n", "benchmark", "metric", "baseline", "current", "change", "status");
+    for (auto const& [name, curMetrics] : cur) {
+        auto baseIter = base.find(name);
+        if (baseIter == base.end()) {
+            fmt::print("{:<30} not in baseline\n", name);
+            continue;
+        }
+        for (auto const& metric : metrics) {
+            auto b = baseIter->second.find(metric.name);
+            auto c = curMetrics.find(metric.name);
+            if (b == baseIter->second.end() || c == curMetrics.end()) continue;
+
+            auto baseMedian = median(b->second);
+            auto curMedian  = median(c->second);
+            if (baseMedian == 0.) continue;
+            auto change = (curMedian - baseMedian) / baseMedian;
+            auto worse  = metric.better == Better::Lower ? change : -change;
+            auto noise  = 3. * std::max(mad(b->second), mad(c->second));
+            bool significant = std::abs(curMedian - baseMedian) > noise;
+
+            auto status = "ok";
+            if (worse > metric.tolerance && significant) {
+                status = "REGRESSION";
+                regressions += 1;
+            } else if (-worse > metric.tolerance && significant) {
+                status = "improved";
+            }
+            fmt::print("{:<30} {:<20} {:>12.3f} {:>12.3f} {:>+8.1f}%  {}\n", name, metric.name, baseMedian, curMedian, change * 100., status);
+        }
+    }
+    for (auto const& [name, _] : base) {
+        if (!cur.contains(name)) {
+            fmt::print("{:<30} missing in current results\n", name);
+        }
+    }
+    fmt::print("{} regressions\n", regressions);
+    return regressions;
+}
+
+auto runBenchmarks() -> std::vector<Run> {
+    auto sahara = cliSahara ? *cliSahara : std::filesystem::canonical("/proc/self/exe").parent_path() / "sahara";
+    if (!std::filesystem::exists(sahara)) {
+        throw error_fmt{"sahara binary not found at {}, use --sahara", sahara};
+    }
+    auto dir = *cliWorkDir;
+    std::filesystem::create_directories(dir);
+
+    // deterministic input data, every file has its own seed
+    {
+        auto stopWatch = StopWatch();
+        auto generator = std::mt19937_64{*cliSeed};
+        generateReference(dir / "ref.fasta", generator);
+
+        auto sequences = std::vector<std::string>{};
+        for (auto record : ivio::fasta::reader{{.input = dir / "ref.fasta"}}) {
+            sequences.emplace_back(record.seq);
+        }
+        for (size_t e{0}; e <= *cliMaxErrors; ++e) {
+            generateReads(dir / fmt::format("reads-e{}.fasta", e), sequences, e, *cliSeed + 1 + 2*e);
+        }
+        fmt::print("generated reference and reads in {:.2f}s\n", stopWatch.reset());
+    }
+
+    auto runs = std::vector<Run>{};
+    for (auto const& b : benchmarks(dir)) {
+        if (cliFilter && b.name.find(*cliFilter) == std::string::npos) continue;
+        auto command = shellQuote(sahara.string());
+        for (auto const& arg : b.args) {
+            command += " " + shellQuote(arg);
+        }
+        for (size_t repeat{0}; repeat < *cliRepeats; ++repeat) {
+            auto stopWatch = StopWatch();
+            auto output    = runCommand(command);
+            auto wallTime  = stopWatch.reset();
+            auto metrics   = parseStats(output);
+            fmt::print("{:<30} {:>10.2f}s", b.name, wallTime);
+            for (auto key : {"search time", "locate time", "number of hits"}) {
+                if (auto iter = metrics.find(key); iter != metrics.end()) {
+                    fmt::print("  {} {}", key, iter->second);
+                }
+            }
+            fmt::print("\n");
+            runs.push_back({b.name, command, repeat, wallTime, std::move(metrics)});
+        }
+    }
+    writeResults(*cliOutput, runs);
+    fmt::print("results written to {}\n", *cliOutput);
+    return runs;
+}
+
+// returns the exit code, 1 if the comparison with the baseline found a regression
+auto app() -> int {
+    if (cliCompareOnly && !cliBaseline) {
+        throw error_fmt{"--compare_only requires --baseline"};
+    }
+    auto runs = cliCompareOnly ? loadResults(*cliOutput) : runBenchmarks();
+    if (cliBaseline) {
+        if (compareResults(loadResults(*cliBaseline), runs) > 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+}
+
+int main(int argc, char** argv) {
+    clice::parse({
+        .args            = {argc, argv},
+        .desc            = "sahara-bench - reproducible benchmarks of sahara",
+        .allowDashCombi  = true,
+        .helpOpt         = true,
+        .catchExceptions = true,
+    });
+    try {
+        return app();
+    } catch (std::exception const& e) {
+        fmt::print(stderr, "error: {}\n", e.what());
+        return 1;
+    }
+}
@@ -2,6 +2,10 @@
 // SPDX-FileCopyrightText: 2016-2023, Knut Reinert & MPI für molekulare Genetik
 // SPDX-License-Identifier: BSD-3-Clause
 
+#include "SemiExternalSA.h"
+#include "SequenceBuffer.h"
+#include "SequenceReader.h"
+
 #include <clice/clice.h>
 #include <fstream>
 #include <ivio/ivio.h>
@@ -32,6 +36,20 @@ auto cliOutput = clice::Argument {
     .tags   = {"required"},
 };
 
+auto cliRamBudget = clice::Argument {
+    .parent = &cli,
+    .args   = "--ram_budget",
+    .desc   = "construct the suffix arrays semi external, using at most this many MB for suffix array buckets (0: in memory construction)",
+    .value  = size_t{},
+};
+
+auto cliScratchDir = clice::Argument {
+    .parent = &cli,
+    .args   = "--scratch_dir",
+    .desc   = "keep the text in a memory mapped file inside this directory instead of main memory",
+    .value  = std::filesystem::path{},
+};
+
 char randomPick() {
     switch(rand()% 4) {
         case 0: return 'A';
@@ -42,21 +60,19 @@ char randomPick() {
     throw std::runtime_error("should never happen");
 }
 
-auto loadFastaAsSingleText(std::filesystem::path input) -> std::vector<uint8_t> {
+void loadFastaAsSingleText(std::filesystem::path input, SequenceBuffer& buffer) {
     // read all queries into one giant text (Columba can not handle mutlistrings
-    auto text = std::vector<uint8_t>{};
-    for (auto record : ivio::fasta::reader {{input}}) {
-        text.reserve(text.size() + record.seq.size()+1);
-        for (auto c : record.seq) {
-            c = ivs::dna4::normalize_char(c);
+    for (auto record : SequenceReader{input}) {
+        auto seq = buffer.append(record.seq.size());
+        for (size_t i{0}; i < seq.size(); ++i) {
+            auto c = ivs::dna4::normalize_char(record.seq[i]);
             if (!ivs::verify_char(c)) {
                 c = randomPick();
             }
-            text.emplace_back(c);
+            seq[i] = c;
         }
     }
-    text.emplace_back('$');
-    return text;
+    buffer.append(1)[0] = '$';
 }
 
 auto createSA(std::span<uint8_t const> text) -> std::vector<int64_t> {
@@ -86,19 +102,44 @@ void writeSA(std::filesystem::path output, std::span<int64_t const> sa) {
     }
 }
 
+// constructs the suffix array bucket wise and writes each bucket directly to disk
+void writeSASemiExternal(std::filesystem::path output, std::span<uint8_t const> text, size_t ramBudget) {
+    auto ofs = std::ofstream{output};
+
+    bool first{true};
+    createSASemiExternal(text, ramBudget, [&](std::span<int64_t const> sa) {
+        for (auto v : sa) {
+            if (!first) ofs << ' ';
+            ofs << v;
+            first = false;
+        }
+    });
+}
+
+void constructAndWriteSA(std::filesystem::path output, std::span<uint8_t const> text) {
+    if (*cliRamBudget == 0) {
+        auto sa   = createSA(text);
+
+        fmt::print("saving Suffix Array disk...\n");
+        writeSA(output, sa);
+    } else {
+        fmt::print("semi external construction with {}MB budget, writing directly to disk...\n", *cliRamBudget);
+        writeSASemiExternal(output, text, *cliRamBudget * 1024 * 1024);
+    }
+}
+
 void app() {
     fmt::print("reading string T from fasta file...\n");
-    auto text = loadFastaAsSingleText(*cliInput);
+    auto buffer = SequenceBuffer{*cliScratchDir};
+    loadFastaAsSingleText(*cliInput, buffer);
+    auto text = buffer.text();
     {
         fmt::print("saving text T to disk...\n");
         writeText(*cliOutput + ".txt", text);
         fmt::print("-> {}\n", *cliOutput + ".txt");
 
         fmt::print("constructing Suffix Array for T...\n");
-        auto sa   = createSA(text);
-
-        fmt::print("saving Suffix Array disk...\n");
-        writeSA(*cliOutput + ".sa", sa);
+        constructAndWriteSA(*cliOutput + ".sa", text);
         fmt::print("-> {}\n", *cliOutput + ".sa");
     }
     {
@@ -110,10 +151,7 @@ void app() {
         fmt::print("-> {}\n", *cliOutput + ".rev.txt");
 
         fmt::print("constructing Suffix Array for reverse T...\n");
-        auto sa   = createSA(text);
-
-        fmt::print("saving Suffix Array (reversed T) disk...\n");
-        writeSA(*cliOutput + ".rev.sa", sa);
+        constructAndWriteSA(*cliOutput + ".rev.sa", text);
         fmt::print("-> {}\n", *cliOutput + ".rev.sa");
     }
 }
@@ -2,6 +2,14 @@
 // SPDX-FileCopyrightText: 2016-2024, Knut Reinert & MPI für molekulare Genetik
 // SPDX-License-Identifier: BSD-3-Clause
 
+#include "IndexManifest.h"
+#include "QGramStats.h"
+#include "ReferenceNames.h"
+#include "SequenceBuffer.h"
+#include "SequenceReader.h"
+#include "utils/AllocationStats.h"
+#include "utils/MemoryStats.h"
+#include "utils/Profiler.h"
 #include "utils/StopWatch.h"
 #include "utils/error_fmt.h"
 
@@ -13,6 +21,8 @@
 #include <fmindex-collection/fmindex-collection.h>
 #include <ivio/ivio.h>
 #include <ivsigma/ivsigma.h>
+#include <algorithm>
+#include <optional>
 #include <string>
 
 namespace {
@@ -38,81 +48,357 @@ auto cliUseDna4 = clice::Argument {
 
 
 
+auto cliShardSize = clice::Argument {
+    .parent = &cli,
+    .args   = "--shard_size",
+    .desc   = "split the index into shards of at most this many bases, split happens at record boundaries (0: single index)",
+    .value  = size_t{},
+};
+
+auto cliAppend = clice::Argument {
+    .parent = &cli,
+    .args   = "--append",
+    .desc   = "append the references to an existing index, they are stored as additional shards of this index",
+    .value  = std::filesystem::path{},
+};
+
+auto cliScratchDir = clice::Argument {
+    .parent = &cli,
+    .args   = "--scratch_dir",
+    .desc   = "keep the loaded references in a memory mapped file inside this directory instead of main memory",
+    .value  = std::filesystem::path{},
+};
+
+auto cliRamBudget = clice::Argument {
+    .parent = &cli,
+    .args   = "--ram_budget",
+    .desc   = "approximate memory budget in MB for constructing a single shard, used to pick --shard_size if not given (0: no limit)",
+    .value  = size_t{},
+};
+
+auto cliQGramStats = clice::Argument {
+    .parent = &cli,
+    .args   = "--qgram_stats",
+    .desc   = "store occurrence statistics of all q-grams up to this length next to the index, used by search --dynamic_generator (0: none)",
+    .value  = size_t{},
+};
+
+auto cliTrackAllocations = clice::Argument {
+    .parent = &cli,
+    .args   = "--track_allocations",
+    .desc   = "count allocations and allocated bytes of every stage",
+};
+
+auto cliStatsJson = clice::Argument {
+    .parent = &cli,
+    .args   = "--stats-json",
+    .desc   = "write timings, counters and per thread scopes as json to this file",
+    .value  = std::filesystem::path{},
+};
+
+auto cliTrace = clice::Argument {
+    .parent = &cli,
+    .args   = "--trace",
+    .desc   = "write a chrome trace-event file (chrome://tracing, perfetto) of this run",
+    .value  = std::filesystem::path{},
+};
+
+/* Estimated peak memory per base while constructing a BiFMIndex, derived
+ * from the buffers alive at the same time (not measured):
+ *  - loaded references and the delimited text, 1 byte each
+ *  - libsais64 suffix arrays of the text and of the reversed text, 8 bytes each
+ *  - both bwts, 1 byte each
+ *  - both occurrence tables (InterleavedBitvector16), about 1.5 bytes each
+ *  - sampled suffix array (rate 16) with its marker bit vector, about 1 byte
+ */
+constexpr size_t ConstructionBytesPerBase = 1 + 1 + 8 + 8 + 1 + 1 + 3 + 1;
+
 template <typename Alphabet>
 void createIndex() {
     constexpr size_t Sigma = Alphabet::size();
+    using Index = fmc::BiFMIndex<Sigma, fmc::string::InterleavedBitvector16>;
 
     fmt::print("constructing an index for {}\n", *cli);
 
+    auto& profiler = Profiler::instance();
+    if (cliTrackAllocations) {
+        enableAllocationTracking();
+    }
     auto timing = std::vector<std::tuple<std::string, double>>{};
     auto stopWatch = StopWatch();
+    // sums up times of stages that are repeated for each shard
+    auto addTiming = [&](std::tuple<std::string, double> const& stage) {
+        auto const& [name, time] = stage;
+        for (auto& [key, t] : timing) {
+            if (key == name) {
+                t += time;
+                return;
+            }
+        }
+        timing.emplace_back(name, time);
+    };
+
+    auto indexPath = cli->string() + ".idx";
+    if (cliUseDna4) {
+        indexPath = cli->string() + ".dna4.idx";
+    }
+
+    auto saveIndex = [&](std::filesystem::path const& path, Index const& index) {
+        auto ofs       = std::ofstream{path, std::ios::binary};
+        auto archive   = cereal::BinaryOutputArchive{ofs};
+        archive(Sigma);
+        archive(index);
+    };
+
+    auto manifest = IndexManifest{};
+    manifest.sigma = Sigma;
+
+    // single index file that becomes the first shard, when appending to it
+    auto pendingRename = std::optional<std::tuple<std::filesystem::path, std::filesystem::path>>{};
+
+    /* File name of the next shard. A rebuild numbers its shards from 000 and
+     * overwrites existing files, when appending the shards of the index stay
+     * and an unused name is searched.
+     */
+    auto nextShardPath = [&]() -> std::filesystem::path {
+        auto base = indexPath.substr(0, indexPath.size() - std::string_view{".idx"}.size());
+        for (size_t i{manifest.segments.size()};; ++i) {
+            auto path = std::filesystem::path{fmt::format("{}.shard{:03}.idx", base, i)};
+            if (cliAppend && std::filesystem::exists(path)) continue;
+            if (pendingRename && std::get<1>(*pendingRename) == path) continue;
+            return path;
+        }
+    };
+
+    // shards of a previous sharded index at the same path, removed after the rebuild unless overwritten
+    auto staleShards = std::vector<std::filesystem::path>{};
+    if (!cliAppend && std::filesystem::exists(indexPath) && IndexManifest::isManifest(indexPath)) {
+        for (auto const& segment : IndexManifest::load(indexPath).segments) {
+            staleShards.push_back(IndexManifest::segmentPath(indexPath, segment));
+        }
+    }
+    auto removeStaleShards = [&]() {
+        for (auto const& path : staleShards) {
+            auto reused = std::ranges::any_of(manifest.segments, [&](auto const& segment) {
+                return (path.parent_path() / segment.path).lexically_normal() == path.lexically_normal();
+            });
+            if (!reused) {
+                std::filesystem::remove(path);
+            }
+        }
+    };
+
+    if (cliAppend) {
+        indexPath = cliAppend->string();
+        if (!indexPath.ends_with(".idx")) {
+            throw error_fmt{"index {} to append to must have the extension .idx", indexPath};
+        }
+        manifest = IndexManifest::load(indexPath);
+        if (manifest.sigma != Sigma) {
+            throw error_fmt{"index {} has {} letters, but appending requires {} letters", indexPath, manifest.sigma, Sigma};
+        }
+        if (!IndexManifest::isManifest(indexPath)) {
+            // single index, count its references to assign global ids to the new references
+            auto index = Index{};
+            {
+                auto ifs     = std::ifstream{indexPath, std::ios::binary};
+                auto archive = cereal::BinaryInputArchive{ifs};
+                size_t sigma;
+                archive(sigma);
+                archive(index);
+            }
+            // every reference is terminated by exactly one delimiter
+            auto refs = fmc::BiFMIndexCursor<Index>{index}.extendLeft(0).count();
+            auto& segment = manifest.segments[0];
+            segment.refCount  = refs;
+            segment.indexSize = index.size();
+
+            auto shardPath = nextShardPath();
+            segment.path  = shardPath.filename().string();
+            pendingRename = std::tuple{std::filesystem::path{indexPath}, shardPath};
+        }
+        fmt::print("appending to {} with {} shards and {} references\n", indexPath, manifest.segments.size(), manifest.refCount());
+        addTiming(profiler.stage("ld index", stopWatch));
+    }
 
-    // load fasta file
     size_t totalSize{};
-    auto ref = std::vector<std::vector<uint8_t>>{};
-    for (auto record : ivio::fasta::reader {{*cli}}) {
+    size_t refCount{manifest.refCount()};
+    size_t const existingRefCount{refCount};
+    auto ref = SequenceBuffer{*cliScratchDir};
+    size_t shardSize{};
+
+    auto names = ReferenceNames{}; // names of the new references
+
+    // q-gram statistics over the new references, the delimiter has rank 0
+    auto qgrams = std::optional<QGramCounter>{};
+    if (*cliQGramStats > 0) {
+        if (cliAppend) {
+            throw error_fmt{"--qgram_stats can not be combined with --append"};
+        }
+        qgrams.emplace(Sigma-1, 1, *cliQGramStats);
+    }
+
+    // create index over the loaded references and store it as a new shard
+    auto flushShard = [&]() {
+        addTiming(profiler.stage("ld queries", stopWatch));
+
+        auto refSize = ref.size();
+        auto index   = Index{ref.sequences(), /*samplingRate*/16, /*threadNbr*/1};
+        ref.release();
+        addTiming(profiler.stage("index creation", stopWatch));
+
+        auto shardPath = nextShardPath().string();
+        saveIndex(shardPath, index);
+        manifest.segments.push_back(IndexManifest::Segment{
+            .path       = std::filesystem::path{shardPath}.filename().string(),
+            .firstRefId = refCount - refSize,
+            .refCount   = refSize,
+            .indexSize  = index.size(),
+            .fileSize   = std::filesystem::file_size(shardPath),
+        });
+        fmt::print("  shard {}: {} references, {} bases -> {}\n", manifest.segments.size()-1, refSize, shardSize, shardPath);
+        shardSize = 0;
+        addTiming(profiler.stage("saving to disk", stopWatch));
+    };
+
+    auto maxShardSize = *cliShardSize;
+    if (maxShardSize == 0 && *cliRamBudget > 0) {
+        maxShardSize = *cliRamBudget * 1024 * 1024 / ConstructionBytesPerBase;
+        fmt::print("ram budget of {}MB, using shards of at most {} bases\n", *cliRamBudget, maxShardSize);
+    }
+
+    // load fasta file
+    for (auto record : SequenceReader{*cli}) {
+        if (maxShardSize && !ref.empty() && shardSize + record.seq.size() > maxShardSize) {
+            flushShard();
+        }
         totalSize += record.seq.size();
-        ref.emplace_back(ivs::convert_char_to_rank<Alphabet>(record.seq));
+        shardSize += record.seq.size();
+        refCount  += 1;
+        names.names.push_back(ReferenceNames::shortName(record.id));
+        // convert directly into the shared reference buffer
+        auto seq = ref.append(record.seq.size());
+        ivs::convert_char_to_rank<Alphabet>(record.seq, seq);
         if (cliIgnoreUnknown) {
             if (cliUseDna4) {
-                for (auto& v : ref.back()) {
+                for (auto& v : seq) {
                     if (ivs::verify_rank(v)) continue;
                     v = Alphabet::char_to_rank('A') + rand() % 4;
                 }
             } else {
-                for (auto& v : ref.back()) {
+                for (auto& v : seq) {
                     if (ivs::verify_rank(v)) continue;
                     v = Alphabet::char_to_rank('N');
                 }
             }
         }
-        if (auto pos = ivs::verify_rank(ref.back()); pos) {
-            throw error_fmt{"ref '{}' ({}) has invalid character '{}' (0x{:02x}) at position {}", record.id, ref.size(), record.seq[*pos], record.seq[*pos], *pos};
+        if (auto pos = ivs::verify_rank(seq); pos) {
+            throw error_fmt{"ref '{}' ({}) has invalid character '{}' (0x{:02x}) at position {}", record.id, refCount, record.seq[*pos], record.seq[*pos], *pos};
+        }
+        if (qgrams) {
+            qgrams->add(seq);
         }
     }
-    if (ref.empty()) {
+    if (refCount == existingRefCount) {
         throw error_fmt{"reference file {} was empty - abort\n", *cli};
     }
 
+    if (manifest.segments.empty()) {
+        fmt::print("config:\n");
+        fmt::print("  file: {}\n", *cli);
+        fmt::print("  sigma: {}\n", Sigma);
+        fmt::print("  references: {}\n", ref.size());
+        fmt::print("  totalSize: {}\n", totalSize);
 
-    fmt::print("config:\n");
-    fmt::print("  file: {}\n", *cli);
-    fmt::print("  sigma: {}\n", Sigma);
-    fmt::print("  references: {}\n", ref.size());
-    fmt::print("  totalSize: {}\n", totalSize);
+        timing.push_back(profiler.stage("ld queries", stopWatch));
 
-    timing.emplace_back("ld queries", stopWatch.reset());
+        // create index, the references are not needed after construction
+        auto index = Index{ref.sequences(), /*samplingRate*/16, /*threadNbr*/1};
+        ref.release();
 
-    // create index
-    auto index = fmc::BiFMIndex<Sigma, fmc::string::InterleavedBitvector16>{ref, /*samplingRate*/16, /*threadNbr*/1};
+        timing.push_back(profiler.stage("index creation", stopWatch));
 
-    timing.emplace_back("index creation", stopWatch.reset());
+        // save index
+        saveIndex(indexPath, index);
+        removeStaleShards();
 
-    // save index
-    auto indexPath = cli->string() + ".idx";
-    if (cliUseDna4) {
-        indexPath = cli->string() + ".dna4.idx";
+        timing.push_back(profiler.stage("saving to disk", stopWatch));
+    } else {
+        flushShard();
+        if (pendingRename) {
+            auto const& [from, to] = *pendingRename;
+            std::filesystem::rename(from, to);
+        }
+        manifest.save(indexPath);
+        removeStaleShards();
+
+        fmt::print("config:\n");
+        fmt::print("  file: {}\n", *cli);
+        fmt::print("  sigma: {}\n", Sigma);
+        fmt::print("  references: {}\n", refCount);
+        fmt::print("  new references: {}\n", refCount - existingRefCount);
+        fmt::print("  totalSize: {}\n", totalSize);
+        fmt::print("  shards: {}\n", manifest.segments.size());
+        fmt::print("  shard size: {}\n", maxShardSize);
     }
-    auto ofs       = std::ofstream{indexPath, std::ios::binary};
-    auto archive   = cereal::BinaryOutputArchive{ofs};
-    archive(Sigma);
-    archive(index);
-    ofs.close();
 
-    timing.emplace_back("saving to disk", stopWatch.reset());
+    // the names of existing references are only known if the index already had a names file
+    if (auto path = ReferenceNames::path(indexPath); !cliAppend || std::filesystem::exists(path)) {
+        names.save(path, /*append=*/cliAppend);
+        fmt::print("  reference names: {}\n", path);
+    } else {
+        fmt::print("  reference names: - (the index to append to has none)\n");
+    }
+
+    if (qgrams) {
+        auto path = QGramStats::path(indexPath);
+        qgrams->stats().save(path);
+        fmt::print("  q-gram stats: {} (q = {})\n", path, qgrams->q);
+    } else if (std::filesystem::exists(QGramStats::path(indexPath))) {
+        // statistics of a previous build or of the existing references don't describe this index, search would pick them up
+        std::filesystem::remove(QGramStats::path(indexPath));
+        fmt::print("  removed outdated q-gram stats {}\n", QGramStats::path(indexPath));
+    }
 
     fmt::print("stats:\n");
     double totalTime{};
     for (auto const& [key, time] : timing) {
-        fmt::print("  {:<20} {:> 10.2f}s\n", key + " time:", time);
+        auto memory = profiler.stageMemory(key);
+        fmt::print("  {:<20} {:> 10.2f}s {:>+10.1f}MB rss {:>10.1f}MB peak", key + " time:", time, memory.rssDelta / 1024. / 1024., memory.peakRss / 1024. / 1024.);
+        if (allocationTrackingEnabled()) {
+            fmt::print(" {:>10} allocations {:>10.1f}MB", memory.allocations, memory.allocatedBytes / 1024. / 1024.);
+        }
+        fmt::print("\n");
         totalTime += time;
     }
     fmt::print("  total time:          {:> 10.2f}s\n", totalTime);
+    fmt::print("  peak memory:         {:> 10.2f}MB\n", peakRss() / 1024. / 1024.);
+
+    if (cliStatsJson) {
+        profiler.writeStatsJson(*cliStatsJson, "index", timing, {
+            {"references", refCount},
+            {"total_size", totalSize},
+            {"shards", std::max<size_t>(1, manifest.segments.size())},
+            {"peak_memory_bytes", peakRss()},
+        });
+    }
+    if (cliTrace) {
+        profiler.writeChromeTrace(*cliTrace);
+    }
 
 }
 
 
 void app() {
+    if (cliAppend) {
+        // the alphabet is given by the existing index
+        auto sigma = IndexManifest::load(*cliAppend).sigma;
+        if (sigma == ivs::d_dna4::size() && !cliUseDna4) {
+            throw error_fmt{"index {} is a dna4 index, appending requires --dna4", *cliAppend};
+        } else if (sigma == ivs::d_dna5::size() && cliUseDna4) {
+            throw error_fmt{"index {} is a dna5 index, appending does not allow --dna4", *cliAppend};
+        }
+    }
     if (cliUseDna4) {
         createIndex<ivs::d_dna4>();
     } else {
@@ -4,39 +4,180 @@
 
 #pragma once
 
-#include <fmindex-collection/search_scheme/isComplete.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <fmindex-collection/search_scheme/all.h>
+#include <thread>
+#include <vector>
 
-namespace fmc::search_schemes {
+/* Completeness and non-redundancy of search schemes
+ *
+ * An error configuration assigns a number of errors to every part, a search
+ * covers it if the accumulated errors (in the order of pi) stay inside l and
+ * u. A scheme is complete if every configuration with minK to maxK errors is
+ * covered, and non-redundant if every such configuration is covered by
+ * exactly one search.
+ *
+ * Instead of enumerating and testing every configuration:
+ *  - the number of configurations covered by a single search is counted by
+ *    dynamic programming over (step, accumulated errors). A complete scheme
+ *    is non-redundant iff these counts sum up to the number of configurations.
+ *  - completeness is checked by a depth first search over configuration
+ *    prefixes, which keeps only the searches that can still cover a
+ *    completion of the prefix. A prefix no search can cover is a
+ *    counterexample, a prefix that one search covers for every completion is
+ *    not expanded further. The subtrees of the first part run on separate
+ *    threads.
+ */
+namespace scheme_check {
 
-namespace complete::detail {
+using Scheme = fmc::search_scheme::Scheme;
+using Search = fmc::search_scheme::Search;
 
-inline auto uniqueCover(Scheme const& ss, ErrorConfig const& errorConfig) -> size_t {
-    size_t ct{};
-    for (auto const& s : ss) {
-        if (covers(s, errorConfig)) {
-            ct += 1;
+// number of error configurations of `parts` parts with minK to maxK errors
+inline auto configCount(size_t parts, size_t minK, size_t maxK) -> uint64_t {
+    // ways[e]: configurations of the parts so far with e errors
+    auto ways = std::vector<uint64_t>(maxK+1, 0);
+    ways[0] = 1;
+    for (size_t p{0}; p < parts; ++p) {
+        for (size_t e{1}; e <= maxK; ++e) {
+            ways[e] += ways[e-1];
         }
     }
-    return ct == 1;
+    uint64_t total{};
+    for (size_t e{minK}; e <= maxK; ++e) {
+        total += ways[e];
+    }
+    return total;
 }
 
-/* checks if Scheme covers patterns up to a certain error
- *
+// number of error configurations with minK to maxK errors covered by a search
+inline auto coverCount(Search const& s, size_t minK, size_t maxK) -> uint64_t {
+    auto ways = std::vector<uint64_t>(maxK+1, 0);
+    ways[0] = 1;
+    for (size_t j{0}; j < s.pi.size(); ++j) {
+        auto next = std::vector<uint64_t>(maxK+1, 0);
+        for (size_t e{0}; e <= maxK; ++e) {
+            if (ways[e] == 0) continue;
+            for (size_t e2{std::max<size_t>(e, s.l[j])}; e2 <= std::min<size_t>(maxK, s.u[j]); ++e2) {
+                next[e2] += ways[e];
+            }
+        }
+        ways = std::move(next);
+    }
+    uint64_t total{};
+    for (size_t e{minK}; e <= maxK; ++e) {
+        total += ways[e];
+    }
+    return total;
+}
+
+namespace detail {
+
+enum class Cover { None, Partial, All };
+
+/* Checks a search against a configuration prefix (errors of the parts
+ * [0, assigned)), the remaining parts share at most `budget` errors.
+ * None: no completion is covered, All: every completion is covered.
  */
-inline auto isUnique(Scheme const& ss, size_t minK, size_t maxK) -> bool {
-    if (ss.empty()) return false;
-    bool unique{true};
-    auto len = ss.at(0).pi.size();
-    generateErrorConfig([&](ErrorConfig const& config) {
-        bool r = uniqueCover(ss, config);
-        unique = unique && r;
-    }, len, minK, maxK);
-    return unique;
+inline auto cover(Search const& s, std::vector<size_t> const& errors, size_t assigned, size_t budget) -> Cover {
+    size_t lo{}, hi{}; // reachable accumulated errors
+    size_t fixed{};    // accumulated errors of assigned parts
+    bool   open{};     // an unassigned part was visited
+    bool   all{true};
+    for (size_t j{0}; j < s.pi.size(); ++j) {
+        auto p = s.pi[j];
+        if (p < assigned) {
+            lo    += errors[p];
+            hi    += errors[p];
+            fixed += errors[p];
+        } else {
+            open = true;
+            hi   = std::min(hi + budget, fixed + budget);
+        }
+        lo = std::max<size_t>(lo, s.l[j]);
+        hi = std::min<size_t>(hi, s.u[j]);
+        if (lo > hi) return Cover::None;
+        all = all && s.l[j] <= fixed && fixed + (open?budget:0) <= s.u[j];
+    }
+    return all?Cover::All:Cover::Partial;
 }
+
+struct Checker {
+    Scheme const& ss;
+    size_t parts;
+    size_t minK;
+    size_t maxK;
+    std::atomic<bool>& incomplete;
+
+    // returns false if an uncovered configuration was found
+    auto check(std::vector<size_t>& errors, size_t assigned, size_t total, std::vector<size_t> const& active) -> bool {
+        if (incomplete) return false;
+        if (assigned == parts && total < minK) return true; // not a configuration of interest
+        auto budget = maxK - total;
+
+        auto remaining = std::vector<size_t>{};
+        for (auto i : active) {
+            auto c = cover(ss[i], errors, assigned, budget);
+            if (c == Cover::All) return true;
+            if (c == Cover::Partial) remaining.push_back(i);
+        }
+        if (remaining.empty()) return false;
+        if (assigned == parts) return true;
+
+        for (size_t e{0}; e <= budget; ++e) {
+            errors[assigned] = e;
+            if (!check(errors, assigned+1, total+e, remaining)) return false;
+        }
+        return true;
+    }
+};
 }
 
-inline auto isNonRedundant(Scheme const& ss, size_t minK, size_t maxK) -> bool {
-    return complete::detail::isUnique(ss, minK, maxK);
+inline auto isComplete(Scheme const& ss, size_t minK, size_t maxK, size_t threads = 1) -> bool {
+    if (ss.empty() || minK > maxK) return false;
+    auto parts = ss[0].pi.size();
+    if (parts == 0) return false;
+    for (auto const& s : ss) {
+        if (s.pi.size() != parts || s.l.size() != parts || s.u.size() != parts) return false;
+    }
+
+    auto incomplete = std::atomic<bool>{};
+    auto checker    = detail::Checker{ss, parts, minK, maxK, incomplete};
+    auto active     = std::vector<size_t>(ss.size());
+    for (size_t i{0}; i < ss.size(); ++i) active[i] = i;
+
+    // each number of errors in the first part is checked as an own task
+    auto next   = std::atomic<size_t>{};
+    auto worker = [&]() {
+        auto errors = std::vector<size_t>(parts);
+        for (auto e = next++; e <= maxK && !incomplete; e = next++) {
+            errors[0] = e;
+            if (!checker.check(errors, 1, e, active)) {
+                incomplete = true;
+            }
+        }
+    };
+    auto pool = std::vector<std::thread>{};
+    for (size_t i{1}; i < std::min(threads, maxK+1); ++i) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (auto& t : pool) {
+        t.join();
+    }
+    return !incomplete;
+}
+
+inline auto isNonRedundant(Scheme const& ss, size_t minK, size_t maxK, size_t threads = 1) -> bool {
+    if (ss.empty()) return false;
+    uint64_t covered{};
+    for (auto const& s : ss) {
+        covered += coverCount(s, minK, maxK);
+    }
+    if (covered != configCount(ss[0].pi.size(), minK, maxK)) return false;
+    return isComplete(ss, minK, maxK, threads);
 }
 
 }
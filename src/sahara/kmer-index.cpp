@@ -3,6 +3,7 @@
 // SPDX-License-Identifier: BSD-3-Clause
 
 #include "AdaptiveKmerIndex.h"
+#include "SequenceReader.h"
 #include "hash.h"
 #include "utils/StopWatch.h"
 #include "utils/error_fmt.h"
@@ -66,7 +67,7 @@ void app() {
     auto stopWatch = StopWatch();
 
     // load fasta file
-    auto reader = ivio::fasta::reader {{*cli}};
+    auto reader = SequenceReader{*cli};
     size_t totalSize{};
     size_t kmerLen{};
     auto ref_kmer = std::vector<std::vector<uint8_t>>{};
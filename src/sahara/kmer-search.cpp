@@ -3,6 +3,8 @@
 // SPDX-License-Identifier: BSD-3-Clause
 
 #include "AdaptiveKmerIndex.h"
+#include "SequenceBuffer.h"
+#include "SequenceReader.h"
 #include "hash.h"
 #include "utils/StopWatch.h"
 #include "utils/error_fmt.h"
@@ -26,7 +28,7 @@ auto cli = clice::Argument {
 auto cliQuery = clice::Argument {
     .parent = &cli,
     .args   = "--query",
-    .desc   = "path to a query file",
+    .desc   = "path to a query file (fasta or fastq, may be gzip/bgzf compressed)",
     .value  = std::filesystem::path{},
 };
 
@@ -137,18 +139,18 @@ void app() {
 
     timing.emplace_back("ld index", stopWatch.reset());
 
-    // load fasta file
-    auto reader = ivio::fasta::reader {{*cliQuery}};
+    // load fasta or fastq file
     size_t totalSize{};
     size_t kmerLen{};
-    auto ref_kmer = std::vector<std::vector<uint8_t>>{};
+    auto ref_kmer = SequenceBuffer{};
     size_t smallestKmer = std::numeric_limits<size_t>::max();
     size_t longestKmer{};
     size_t skipped{};
     [&]() {
         auto ref = std::vector<uint8_t>{};
+        auto kmers = std::vector<uint8_t>{}; // kmers of the current query, reused between queries
         size_t recordNbr = 0;
-        for (auto record : reader) {
+        forEachSequenceRecord(*cliQuery, [&](auto const& record) {
             recordNbr += 1;
             totalSize += record.seq.size();
             ref.resize(record.seq.size());
@@ -158,13 +160,12 @@ void app() {
             }
 
             [&]() {
-                ref_kmer.emplace_back();
+                kmers.clear();
                 if (config.mode == AdaptiveKmerIndex::KmerMode::Winnowing) {
                     for (auto v : ivs::winnowing_minimizer<Alphabet, /*DuplicatesAllowed=*/false>(ref, /*.k=*/config.kmerLen, /*.window=*/config.window)) {
                         if (auto iter = uniq.find(v); iter != uniq.end()) {
-                            ref_kmer.back().emplace_back(iter->second);
+                            kmers.emplace_back(iter->second);
                         } else {
-                            ref_kmer.pop_back();
                             return;
                         }
                     }
@@ -174,32 +175,30 @@ void app() {
                         v = hash(v);
                         if ((v & mask) != 0) continue;
                         if (auto iter = uniq.find(v); iter != uniq.end()) {
-                            ref_kmer.back().emplace_back(iter->second);
+                            kmers.emplace_back(iter->second);
                         } else {
-                            ref_kmer.pop_back();
                             return;
                         }
                     }
                 } else {
                     throw error_fmt("unknown kmer mode: {}", uint8_t(config.mode));
                 }
-                if (ref_kmer.back().size() >= 6) {
-                    smallestKmer = std::min(ref_kmer.back().size(), smallestKmer);
-                    longestKmer = std::max(ref_kmer.back().size(), longestKmer);
-                    kmerLen += ref_kmer.back().size();
+                if (kmers.size() >= 6) {
+                    smallestKmer = std::min(kmers.size(), smallestKmer);
+                    longestKmer = std::max(kmers.size(), longestKmer);
+                    kmerLen += kmers.size();
+                    std::ranges::copy(kmers, ref_kmer.append(kmers.size()).begin());
                     if (!cliNoReverse) {
-                        ref_kmer.emplace_back(ref_kmer.back());
-                        std::ranges::reverse(ref_kmer.back());
+                        std::ranges::reverse_copy(kmers, ref_kmer.append(kmers.size()).begin());
                     }
                 } else {
                     skipped += 1;
-                    ref_kmer.pop_back();
                     if (!cliNoReverse) {
                         skipped += 1;
                     }
                 }
             }();
-        }
+        });
     }();
     fmt::print("skipped {} of {} queries\n", skipped, skipped + ref_kmer.size());
     fmt::print("avg kmer len: {}\n", kmerLen * 1.0/ ref_kmer.size());
@@ -247,5 +246,6 @@ void app() {
     fmt::print("  total time:          {:> 10.2f}s\n", totalTime);
     fmt::print("  queries per second:  {:> 10.0f}q/s\n", ref_kmer.size() / totalTime);
     fmt::print("  number of hits:      {:>10}\n", results.size());
+    fmt::print("  query allocations:   {:>10}\n", ref_kmer.allocations());
 }
 }
@@ -2,6 +2,7 @@
 // SPDX-FileCopyrightText: 2016-2024, Knut Reinert & MPI für molekulare Genetik
 // SPDX-License-Identifier: BSD-3-Clause
 
+#include "SequenceReader.h"
 #include "dr_dna.h"
 #include "utils/StopWatch.h"
 #include "utils/error_fmt.h"
@@ -47,7 +48,7 @@ void app() {
     // load fasta file
     size_t totalSize{};
     auto ref = std::vector<std::vector<uint8_t>>{};
-    for (auto record : ivio::fasta::reader {{*cli}}) {
+    for (auto record : SequenceReader{*cli}) {
         totalSize += record.seq.size();
         ref.emplace_back(ivs::convert_char_to_rank<Alphabet>(record.seq));
         if (cliIgnoreUnknown) {
@@ -2,6 +2,9 @@
 // SPDX-FileCopyrightText: 2016-2024, Knut Reinert & MPI für molekulare Genetik
 // SPDX-License-Identifier: BSD-3-Clause
 
+#include "HitBuffer.h"
+#include "SequenceBuffer.h"
+#include "SequenceReader.h"
 #include "dr_dna.h"
 
 #include "utils/StopWatch.h"
@@ -19,6 +22,8 @@
 #include <fstream>
 #include <ivio/ivio.h>
 #include <ivsigma/ivsigma.h>
+#include <numeric>
+#include <span>
 #include <string>
 #include <unordered_set>
 
@@ -33,7 +38,7 @@ auto cli = clice::Argument {
 auto cliQuery = clice::Argument {
     .parent = &cli,
     .args   = {"-q", "--query"},
-    .desc   = "path to a query file",
+    .desc   = "path to a query file (fasta or fastq, may be gzip/bgzf compressed)",
     .value  = std::filesystem::path{},
 };
 
@@ -86,6 +91,14 @@ auto cliMaxHits   = clice::Argument {
     .desc   = "maximum number of hits per query",
     .value  = 0,
 };
+enum class Engine { Auto, Ng24, Ng21, Pseudo, Backtracking };
+auto cliEngine = clice::Argument {
+    .parent  = &cli,
+    .args    = "--engine",
+    .desc    = "search engine: auto (ng21), ng24, ng21, pseudo or backtracking (ignores the search scheme)",
+    .value   = Engine::Auto,
+    .mapping = {{{"auto", Engine::Auto}, {"ng24", Engine::Ng24}, {"ng21", Engine::Ng21}, {"pseudo", Engine::Pseudo}, {"backtracking", Engine::Backtracking}}},
+};
 
 void app() {
     using Alphabet = dr_dna5;
@@ -95,19 +108,22 @@ void app() {
 
     auto stopWatch = StopWatch();
 
-    // load fasta file
+    // load fasta or fastq file
     size_t totalSize{};
-    auto queries = std::vector<std::vector<uint8_t>>{};
-    for (auto record : ivio::fasta::reader {{*cliQuery}}) {
+    auto queryBuffer = SequenceBuffer{};
+    forEachSequenceRecord(*cliQuery, [&](auto const& record) {
         totalSize += record.seq.size();
-        queries.emplace_back(ivs::convert_char_to_rank<Alphabet>(record.seq));
-        if (auto pos = ivs::verify_rank(queries.back()); pos) {
-            throw error_fmt{"query '{}' ({}) has invalid character at position {} '{}'({:x})", record.id, queries.size(), *pos, record.seq[*pos], record.seq[*pos]};
+        auto query = queryBuffer.append(record.seq.size());
+        ivs::convert_char_to_rank<Alphabet>(record.seq, query);
+        if (auto pos = ivs::verify_rank(query); pos) {
+            throw error_fmt{"query '{}' ({}) has invalid character at position {} '{}'({:x})", record.id, queryBuffer.size(), *pos, record.seq[*pos], record.seq[*pos]};
         }
-    }
-    if (queries.empty()) {
+    });
+    if (queryBuffer.empty()) {
         throw error_fmt{"query file {} was empty - abort\n", *cliQuery};
     }
+    // views into the query buffer, which are handed to the search engines
+    auto queries = queryBuffer.sequences();
     timing.emplace_back("ld queries", stopWatch.reset());
 
     fmt::print(
@@ -166,16 +182,39 @@ void app() {
         return oss;
     };
 
-    auto resultCursors = std::vector<std::tuple<size_t, fmc::LeftMirroredBiFMIndexCursor<decltype(index)>, size_t>>{};
-    auto res_cb = [&](size_t queryId, auto cursor, size_t errors) {
-        resultCursors.emplace_back(queryId, cursor, errors);
+    // the index is searched with the edit distance, ng21 stays the default
+    auto engine = *cliEngine == Engine::Auto ? Engine::Ng21 : *cliEngine;
+    if ((engine == Engine::Pseudo || engine == Engine::Backtracking) && *cliMaxHits != 0) {
+        throw error_fmt{"engines pseudo and backtracking do not support --max_hits"};
+    }
+
+    auto hits   = HitBuffer{};
+    auto res_cb = hits.sink();
+    // searches with a single scheme, reporting all hits
+    auto runAll = [&](auto const& queries, auto const& search_scheme, auto& cb) {
+        switch (engine) {
+        case Engine::Auto:
+        case Engine::Ng21:
+            if (*cliMaxHits == 0) fmc::search_ng21::search(index, queries, search_scheme, cb);
+            else                  fmc::search_ng21::search_n(index, queries, search_scheme, *cliMaxHits, cb);
+            break;
+        case Engine::Ng24:
+            if (*cliMaxHits == 0) fmc::search_ng24::search</*Edit=*/true>(index, queries, search_scheme, cb);
+            else                  fmc::search_ng24::search_n</*Edit=*/true>(index, queries, search_scheme, *cliMaxHits, cb);
+            break;
+        case Engine::Pseudo:
+            fmc::search_pseudo::search</*Edit=*/true>(index, queries, search_scheme, cb);
+            break;
+        case Engine::Backtracking:
+            fmc::search_backtracking::search(index, queries, size_t(search_scheme[0].u.back()), cb);
+            break;
+        }
     };
     if (*cliSearchMode == SearchMode::All) {
         auto search_scheme  = loadSearchScheme(0, k);
         timing.emplace_back("searchScheme", stopWatch.reset());
 
-        if (*cliMaxHits == 0) fmc::search_ng21::search(index, queries, search_scheme, res_cb);
-        else                  fmc::search_ng21::search_n(index, queries, search_scheme, *cliMaxHits, res_cb);
+        runAll(queries, search_scheme, res_cb);
     } else {
         auto search_schemes = std::vector<decltype(loadSearchScheme(0, k))>{};
         for (size_t j{0}; j<=k; ++j) {
@@ -183,18 +222,43 @@ void app() {
         }
         timing.emplace_back("searchScheme", stopWatch.reset());
 
-        if (*cliMaxHits == 0) fmc::search_ng21::search_best(index, queries, search_schemes, res_cb);
-        else                  fmc::search_ng21::search_best_n(index, queries, search_schemes, *cliMaxHits, res_cb);
+        if (engine == Engine::Ng21) {
+            if (*cliMaxHits == 0) fmc::search_ng21::search_best(index, queries, search_schemes, res_cb);
+            else                  fmc::search_ng21::search_best_n(index, queries, search_schemes, *cliMaxHits, res_cb);
+        } else {
+            // no native best hits search, the next error level only searches the queries without hits
+            auto pending = std::vector<size_t>(queries.size());
+            std::iota(pending.begin(), pending.end(), 0);
+            for (size_t j{0}; j < search_schemes.size() && !pending.empty(); ++j) {
+                auto group = std::vector<std::span<uint8_t const>>{};
+                for (auto q : pending) {
+                    group.push_back(queries[q]);
+                }
+                auto found    = std::vector<bool>(group.size());
+                auto level_cb = [&](size_t queryId, auto const& cursor, size_t errors) {
+                    found[queryId] = true;
+                    res_cb(pending[queryId], cursor, errors);
+                };
+                runAll(group, search_schemes[j], level_cb);
+                auto next = std::vector<size_t>{};
+                for (size_t i{0}; i < pending.size(); ++i) {
+                    if (!found[i]) next.push_back(pending[i]);
+                }
+                pending = std::move(next);
+            }
+        }
     }
     timing.emplace_back("search", stopWatch.reset());
 
     auto results = std::vector<std::tuple<size_t, size_t, size_t, size_t>>{};
-    for (auto const& [queryId, cursor, e] : resultCursors) {
-        for (auto [sae, offset] : fmc::LocateLinear{index, cursor}) {
+    results.reserve(hits.rows());
+    hits.forEach([&](size_t queryId, size_t lb, size_t len, size_t e) {
+        for (size_t row{lb}; row < lb + len; ++row) {
+            auto [sae, offset] = index.locate(row);
             auto [seqId, seqPos] = sae;
             results.emplace_back(queryId, seqId, seqPos + offset, e);
         }
-    }
+    });
 
     timing.emplace_back("locate", stopWatch.reset());
 
@@ -218,5 +282,7 @@ void app() {
     fmt::print("  total time:          {:> 10.2f}s\n", totalTime);
     fmt::print("  queries per second:  {:> 10.0f}q/s\n", queries.size() / totalTime);
     fmt::print("  number of hits:      {:>10}\n", results.size());
+    fmt::print("  query allocations:   {:>10}\n", queryBuffer.allocations());
+    fmt::print("  hit buffer memory:   {:>10.1f}MB\n", hits.bytes() / 1024. / 1024.);
 }
 }
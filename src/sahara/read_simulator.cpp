@@ -2,7 +2,9 @@
 // SPDX-FileCopyrightText: 2016-2023, Knut Reinert & MPI für molekulare Genetik
 // SPDX-License-Identifier: BSD-3-Clause
 
-#include "error_fmt.h"
+#include "ReadSimulator.h"
+#include "SequenceReader.h"
+#include "utils/error_fmt.h"
 
 #include <clice/clice.h>
 #include <ivio/ivio.h>
@@ -98,7 +100,7 @@ char randomPick() {
 
 auto loadFasta(std::filesystem::path input) -> std::vector<std::string> {
     auto sequences = std::vector<std::string>{};
-    for (auto record : ivio::fasta::reader {{input}}) {
+    for (auto record : SequenceReader{input}) {
         auto seq = std::string{};
         seq.reserve(record.seq.size());
         for (auto c : record.seq) {
@@ -115,132 +117,6 @@ auto loadFasta(std::filesystem::path input) -> std::vector<std::string> {
 
 std::mt19937_64 generator;
 
-// Creates a new edit transcript of a certain length
-struct Transcript {
-    std::string transcript;
-    size_t matches{};
-
-    Transcript(size_t len, size_t sub=0, size_t ins=0, size_t del=0)
-        : transcript(len, 'M')
-        , matches{len}
-    {
-        addErrors(sub, ins, del);
-    }
-
-    // replaces a match with a substitution
-    void addSubstitution() {
-        if (matches == 0) throw std::runtime_error{"no more matches for this transcript possible"};
-
-        auto pos = std::uniform_int_distribution<size_t>{0, transcript.size()-1}(generator);
-        while (transcript[pos] != 'M') pos = std::uniform_int_distribution<size_t>{0, transcript.size()-1}(generator);
-        transcript[pos] = 'S';
-        matches -= 1;
-    }
-    // adds an insertion
-    void addInsertion() {
-        if (matches == 0) throw std::runtime_error{"no more matches for this transcript possible"};
-
-        auto pos = std::uniform_int_distribution<size_t>{0, transcript.size()-1}(generator);
-        while (transcript[pos] != 'M') pos = std::uniform_int_distribution<size_t>{0, transcript.size()-1}(generator);
-        transcript[pos] = 'I';
-        matches -= 1;
-    }
-    // adds an deletion
-    void addDeletion() {
-        auto pos = std::uniform_int_distribution<size_t>{0, transcript.size()}(generator);
-        transcript.insert(transcript.begin() + pos, 'D');
-    }
-    void addErrors(size_t substitutions, size_t insertions, size_t deletions) {
-        for (size_t i{0}; i < substitutions; ++i) addSubstitution();
-        for (size_t i{0}; i < insertions; ++i)    addInsertion();
-        for (size_t i{0}; i < deletions; ++i)     addDeletion();
-    }
-    auto lengthOfRef() const {
-        size_t a = transcript.size();
-        for (auto t : transcript) {
-            if (t == 'I') {
-                a -= 1;
-            }
-        }
-        return a;
-    }
-};
-
-
-struct ReadGenerator {
-    std::vector<std::string> const& sequences;
-    size_t readLength;
-    size_t totalLength = [&]() {
-        size_t l{};
-        for (auto s : sequences) {
-            l += s.size();
-        }
-        return l;
-    }();
-    std::mt19937_64 generator;
-    std::uniform_int_distribution<size_t> uniform_pos{0, totalLength-1};
-
-    auto generate(size_t len) -> std::tuple<size_t, size_t, std::string_view> {
-        while (true) {
-            // Simulating a single read
-            auto pos = uniform_pos(generator);
-
-            size_t seqId = 0;
-            // pick correct sequence
-            for (std::string_view seq : sequences) {
-                if (pos + len > seq.size()) {
-                    break;
-                }
-                if (pos < seq.size()) {
-                    return {seqId, pos, seq.substr(pos, len)};
-                }
-
-                seqId += 1;
-                pos = pos + readLength - seq.size() - 1;
-            }
-        }
-    }
-
-    auto applyTranscript(std::string_view v, std::span<char const> transcript) {
-        std::string res;
-        size_t p{0};
-        auto uniform_char02 = std::uniform_int_distribution<size_t>{0, 2};
-        auto uniform_char03 = std::uniform_int_distribution<size_t>{0, 3};
-
-        auto substitute_char = [&](char c) {
-            auto r = uniform_char02(generator);
-            return ivs::dna4::rank_to_char((ivs::dna4::char_to_rank(c) + r + 1) % 4);
-        };
-        auto generate_char = [&]() {
-            auto r = uniform_char03(generator);
-            return ivs::dna4::rank_to_char(r);
-        };
-
-        for (auto t : transcript) {
-            switch (t) {
-            case 'M':
-                res.push_back(v[p]);
-                ++p;
-                break;
-            case 'S':
-                res.push_back(substitute_char(v[p]));
-                ++p;
-                break;
-            case 'I':
-                res.push_back(generate_char());
-                break;
-            case 'D':
-                ++p;
-                break;
-            default:
-                throw error_fmt{"Invalid transcript \"{}\"", t};
-            }
-        }
-        return res;
-    }
-};
-
-
 void app() {
     srand(*cliSeed);
     if (cliInput) {
@@ -265,7 +141,7 @@ void app() {
                     case 2: error_del += 1; break;
                 }
             }
-            auto transcript = Transcript{*cliReadLength, error_sub, error_ins, error_del};
+            auto transcript = Transcript{generator, *cliReadLength, error_sub, error_ins, error_del};
             auto [seqId, pos, read] = readGenerator.generate(transcript.lengthOfRef());
 
             auto faultyRead = readGenerator.applyTranscript(read, transcript.transcript);
@@ -2,19 +2,47 @@
 // SPDX-FileCopyrightText: 2016-2024, Knut Reinert & MPI für molekulare Genetik
 // SPDX-License-Identifier: BSD-3-Clause
 
+#include "AdaptivePartition.h"
+#include "ExactSearch.h"
+#include "HitBuffer.h"
+#include "IndexManifest.h"
+#include "LongReads.h"
+#include "PairedEnd.h"
+#include "QGramStats.h"
+#include "ReferenceNames.h"
+#include "SearchTreeStats.h"
+#include "SequenceBuffer.h"
+#include "SequenceReader.h"
+#include "TuningProfile.h"
+#include "utils/AllocationStats.h"
+#include "utils/LatencyHistogram.h"
+#include "utils/MemoryStats.h"
+#include "utils/PerfCounters.h"
+#include "utils/Profiler.h"
 #include "utils/StopWatch.h"
 #include "utils/error_fmt.h"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <cereal/archives/binary.hpp>
 #include <cereal/types/array.hpp>
 #include <cereal/types/vector.hpp>
 #include <clice/clice.h>
+#include <condition_variable>
 #include <fmindex-collection/suffixarray/DenseCSA.h>
 #include <fmindex-collection/fmindex-collection.h>
 #include <fstream>
 #include <ivio/ivio.h>
 #include <ivsigma/ivsigma.h>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <optional>
 #include <string>
+#include <thread>
 #include <unordered_set>
 
 
@@ -29,7 +57,7 @@ auto cli = clice::Argument {
 auto cliQuery = clice::Argument {
     .parent = &cli,
     .args   = {"-q", "--query"},
-    .desc   = "path to a query file",
+    .desc   = "path to a query file (fasta or fastq, may be gzip/bgzf compressed)",
     .value  = std::filesystem::path{},
 };
 
@@ -50,7 +78,7 @@ auto cliOutput = clice::Argument {
 auto cliGenerator  = clice::Argument {
     .parent = &cli,
     .args   = {"-g", "--generator"},
-    .desc   = "picking optimum search scheme generator",
+    .desc   = "picking optimum search scheme generator (default: fastest entry of the index' tuning profile, otherwise h2-k2)",
     .value  = std::string{"h2-k2"},
 };
 
@@ -88,6 +116,19 @@ auto cliDistanceMetric = clice::Argument {
     .value   = DistanceMetric::Levenshtein,
     .mapping = {{{"ham", DistanceMetric::Hamming}, {"lev", DistanceMetric::Levenshtein}}}
 };
+enum class Engine { Auto, Ng24, Ng21, Pseudo, Backtracking };
+auto cliEngine = clice::Argument {
+    .parent  = &cli,
+    .args    = "--engine",
+    .desc    = "search engine: auto, ng24, ng21, pseudo or backtracking (edit distance only, ignores the search scheme)",
+    .value   = Engine::Auto,
+    .mapping = {{{"auto", Engine::Auto}, {"ng24", Engine::Ng24}, {"ng21", Engine::Ng21}, {"pseudo", Engine::Pseudo}, {"backtracking", Engine::Backtracking}}},
+};
+auto cliNoExactPath = clice::Argument {
+    .parent = &cli,
+    .args   = "--no_exact_path",
+    .desc   = "search exact matches (k=0, first best hits level) with the search engine instead of plain backward search",
+};
 auto cliMaxHits = clice::Argument {
     .parent = &cli,
     .args   = "--max_hits",
@@ -101,34 +142,398 @@ auto cliLimitQueries = clice::Argument {
     .value  = size_t{},
 };
 
-template <typename Alphabet>
+auto cliThreads = clice::Argument {
+    .parent = &cli,
+    .args   = {"-t", "--threads"},
+    .desc   = "number of threads searching the queries of an index (shard), each with its own hit buffer",
+    .value  = size_t{1},
+};
+auto cliShardThreads = clice::Argument {
+    .parent = &cli,
+    .args   = "--shard_threads",
+    .desc   = "number of index shards that are searched in parallel (only for sharded indices)",
+    .value  = size_t{1},
+};
+auto cliShardMemory = clice::Argument {
+    .parent = &cli,
+    .args   = "--shard_memory",
+    .desc   = "maximum size in MB of all shards loaded at the same time, a single shard is always loaded (0: unlimited)",
+    .value  = size_t{},
+};
+
+auto cliAdaptivePartition = clice::Argument {
+    .parent = &cli,
+    .args   = "--adaptive_partition",
+    .desc   = "choose the partition of every query from a small set of expansions by q-gram counts of the index (search mode all)",
+};
+
+auto cliRestrictRefs = clice::Argument {
+    .parent = &cli,
+    .args   = "--restrict-refs",
+    .desc   = "only report hits on these references, a comma separated list of names or ids, shards without them are not searched",
+    .value  = std::string{},
+};
+
+auto cliMates = clice::Argument {
+    .parent = &cli,
+    .args   = "--mates",
+    .desc   = "query file of the second mates of paired-end reads, the first mates are read from --query",
+    .value  = std::filesystem::path{},
+};
+auto cliMaxInsert = clice::Argument {
+    .parent = &cli,
+    .args   = "--max_insert",
+    .desc   = "largest insert size used to learn the insert size distribution, and the insert size range if it can not be learned",
+    .value  = size_t{1000},
+};
+auto cliInsertSample = clice::Argument {
+    .parent = &cli,
+    .args   = "--insert_sample",
+    .desc   = "number of uniquely mapped pairs the insert size distribution is learned from",
+    .value  = size_t{10000},
+};
+auto cliMaxPairs = clice::Argument {
+    .parent = &cli,
+    .args   = "--max_pairs",
+    .desc   = "number of proper pairs reported per read pair, fewest errors first",
+    .value  = size_t{1},
+};
+auto cliReference = clice::Argument {
+    .parent = &cli,
+    .args   = "--reference",
+    .desc   = "reference file of the index, enables rescuing an unmapped mate near the hits of the other mate",
+    .value  = std::filesystem::path{},
+};
+auto cliRescueHits = clice::Argument {
+    .parent = &cli,
+    .args   = "--rescue_hits",
+    .desc   = "number of hits (fewest errors first) of the mapped mate, near which an unmapped mate is searched",
+    .value  = size_t{10},
+};
+
+auto cliLongReads = clice::Argument {
+    .parent = &cli,
+    .args   = "--long_reads",
+    .desc   = "split the reads into overlapping segments, search the segments and chain their hits into read mappings",
+};
+auto cliSegmentLength = clice::Argument {
+    .parent = &cli,
+    .args   = "--segment_length",
+    .desc   = "length of the segments of --long_reads",
+    .value  = size_t{100},
+};
+auto cliSegmentStride = clice::Argument {
+    .parent = &cli,
+    .args   = "--segment_stride",
+    .desc   = "distance of the starts of neighbouring segments of --long_reads",
+    .value  = size_t{50},
+};
+auto cliChainMaxGap = clice::Argument {
+    .parent = &cli,
+    .args   = "--chain_max_gap",
+    .desc   = "maximal read or reference distance of neighbouring segment hits of a chain",
+    .value  = size_t{5000},
+};
+auto cliChainBandwidth = clice::Argument {
+    .parent = &cli,
+    .args   = "--chain_bandwidth",
+    .desc   = "maximal difference of the read and reference distance of neighbouring segment hits of a chain",
+    .value  = size_t{500},
+};
+auto cliMinChainScore = clice::Argument {
+    .parent = &cli,
+    .args   = "--min_chain_score",
+    .desc   = "minimal score of a reported chain, chains covering the whole read are always reported (default: two neighbouring segments without errors)",
+    .value  = double{},
+};
+auto cliMaxChains = clice::Argument {
+    .parent = &cli,
+    .args   = "--max_chains",
+    .desc   = "number of chains reported per read and strand, best first",
+    .value  = size_t{1},
+};
+
+auto cliSearchStats = clice::Argument {
+    .parent = &cli,
+    .args   = "--search_stats",
+    .desc   = "measure the search tree of every search of the scheme and compare it to the predicted node count (slow)",
+};
+
+auto cliQueryLatency = clice::Argument {
+    .parent = &cli,
+    .args   = "--query_latency",
+    .desc   = "search the queries one by one and report percentiles of their latency",
+};
+
+auto cliSlowQueries = clice::Argument {
+    .parent = &cli,
+    .args   = "--slow_queries",
+    .desc   = "write id, length, latency, hits and expanded nodes of the slowest queries to this file (implies --query_latency)",
+    .value  = std::filesystem::path{},
+};
+
+auto cliSlowQueryCount = clice::Argument {
+    .parent = &cli,
+    .args   = "--slow_query_count",
+    .desc   = "number of queries written to --slow_queries",
+    .value  = size_t{100},
+};
+
+auto cliPerfCounters = clice::Argument {
+    .parent = &cli,
+    .args   = "--perf-counters",
+    .desc   = "record cycles, instructions, LLC, dTLB and branch misses of every stage (requires perf_event_open)",
+};
+
+auto cliTrackAllocations = clice::Argument {
+    .parent = &cli,
+    .args   = "--track_allocations",
+    .desc   = "count allocations and allocated bytes of every stage",
+};
+
+auto cliStatsJson = clice::Argument {
+    .parent = &cli,
+    .args   = "--stats-json",
+    .desc   = "write timings, counters and per thread scopes as json to this file",
+    .value  = std::filesystem::path{},
+};
+
+auto cliTrace = clice::Argument {
+    .parent = &cli,
+    .args   = "--trace",
+    .desc   = "write a chrome trace-event file (chrome://tracing, perfetto) of this run",
+    .value  = std::filesystem::path{},
+};
+
+// queryId, seqId, pos, errors
+using Result = std::tuple<size_t, size_t, size_t, size_t>;
+
+/* Merges the results of multiple shards, such that the result is the same as
+ * if a single index had been searched. For besthits only the hits with the
+ * smallest number of errors over all shards are kept, maxHits limits the
+ * number of hits per query.
+ */
+auto mergeShardResults(std::vector<std::vector<Result>>& shardResults, bool bestHits, size_t maxHits) -> std::vector<Result> {
+    auto results = std::vector<Result>{};
+    {
+        size_t total{};
+        for (auto const& r : shardResults) {
+            total += r.size();
+        }
+        results.reserve(total);
+        for (auto& r : shardResults) {
+            results.insert(results.end(), r.begin(), r.end());
+            r = {};
+        }
+    }
+    std::ranges::stable_sort(results, [](auto const& lhs, auto const& rhs) {
+        return std::get<0>(lhs) < std::get<0>(rhs);
+    });
+    if (!bestHits && maxHits == 0) {
+        return results;
+    }
+
+    auto out = size_t{0};
+    for (size_t i{0}; i < results.size();) {
+        auto queryId = std::get<0>(results[i]);
+        auto end = i;
+        auto minErrors = std::numeric_limits<size_t>::max();
+        while (end < results.size() && std::get<0>(results[end]) == queryId) {
+            minErrors = std::min(minErrors, std::get<3>(results[end]));
+            ++end;
+        }
+        size_t hits{};
+        for (; i < end; ++i) {
+            if (bestHits && std::get<3>(results[i]) != minErrors) continue;
+            if (maxHits > 0 && hits == maxHits) continue;
+            results[out] = results[i];
+            ++out;
+            ++hits;
+        }
+    }
+    results.resize(out);
+    return results;
+}
+
+auto engineName(Engine engine) -> std::string {
+    switch (engine) {
+    case Engine::Auto:         return "auto";
+    case Engine::Ng24:         return "ng24";
+    case Engine::Ng21:         return "ng21";
+    case Engine::Pseudo:       return "pseudo";
+    case Engine::Backtracking: return "backtracking";
+    }
+    return "unknown";
+}
+
+/* Engine used by --engine auto, the first row matching the workload is used.
+ *
+ * This is a static default, not a measured choice: ng24 for all hits, ng21
+ * (the only engine with a native best hits search) for best hits. ng21 only
+ * supports the edit distance, best hits with the hamming distance search the
+ * error levels one after another with ng24. Compare the engines with
+ * `sahara-bench --filter search/engine` before changing the rows.
+ */
+struct EngineChoice {
+    SearchMode                    mode;
+    std::optional<DistanceMetric> metric; // any metric if not set
+    Engine                        engine;
+};
+constexpr auto autoEngines = std::array<EngineChoice, 3>{{
+    {SearchMode::All,      std::nullopt,                Engine::Ng24},
+    {SearchMode::BestHits, DistanceMetric::Levenshtein, Engine::Ng21},
+    {SearchMode::BestHits, DistanceMetric::Hamming,     Engine::Ng24},
+}};
+
+auto selectEngine(Engine engine, SearchMode mode, DistanceMetric metric) -> Engine {
+    if (engine == Engine::Auto) {
+        for (auto const& row : autoEngines) {
+            if (row.mode == mode && (!row.metric || *row.metric == metric)) {
+                engine = row.engine;
+                break;
+            }
+        }
+    }
+    if ((engine == Engine::Ng21 || engine == Engine::Backtracking) && metric == DistanceMetric::Hamming) {
+        throw error_fmt{"engine {} only supports the levenshtein distance", engineName(engine)};
+    }
+    if ((engine == Engine::Pseudo || engine == Engine::Backtracking) && *cliMaxHits != 0) {
+        throw error_fmt{"engine {} does not support --max_hits", engineName(engine)};
+    }
+    return engine;
+}
+
+// bwt string of the index, counting rank queries if the search is instrumented
+template <bool Instrumented>
+struct IndexString {
+    template <size_t Sigma>
+    using type = fmc::string::InterleavedBitvector16<Sigma>;
+};
+template <>
+struct IndexString<true> {
+    template <size_t Sigma>
+    using type = CountingString<Sigma>;
+};
+
+template <typename Alphabet, bool Instrumented>
 void runSearch() {
     constexpr size_t Sigma = Alphabet::size();
+    using Index = fmc::BiFMIndex<Sigma, IndexString<Instrumented>::template type>;
 
+    auto& profiler = Profiler::instance();
+    if (cliTrackAllocations) {
+        enableAllocationTracking();
+    }
     auto timing = std::vector<std::tuple<std::string, double>>{};
 
     auto stopWatch = StopWatch();
 
-    // load fasta file
-    size_t totalSize{};
-    auto queries = std::vector<std::vector<uint8_t>>{};
-    for (auto record : ivio::fasta::reader {{*cliQuery}}) {
-        totalSize += record.seq.size();
-        queries.emplace_back(ivs::convert_char_to_rank<Alphabet>(record.seq));
-        if (auto pos = ivs::verify_rank(queries.back()); pos) {
-            throw error_fmt{"query '{}' ({}) has invalid character at position {} '{}'({:x})", record.id, queries.size(), *pos, record.seq[*pos], record.seq[*pos]};
-        }
-        if (!cliNoReverse) {
-            queries.emplace_back(ivs::reverse_complement_rank<Alphabet>(queries.back()));
+    // hardware counters are optional, the search runs without them if they are not permitted
+    PerfCounters const* perfCounters{}; // counters of the main thread, owned by the profiler
+    if (cliPerfCounters) {
+        auto const& counters = profiler.enablePerfCounters();
+        if (!counters.anyAvailable()) {
+            fmt::print("perf counters are not available ({}), continuing without them\n", counters.errorMessage());
+            profiler.disablePerfCounters();
+        } else {
+            if (!counters.errorMessage().empty()) {
+                fmt::print("some perf counters are not available ({})\n", counters.errorMessage());
+            }
+            perfCounters = &counters;
         }
     }
+
+    bool measureLatency = cliQueryLatency || cliSlowQueries;
+
+    // load fasta or fastq file
+    size_t totalSize{};
+    auto queryBuffer = SequenceBuffer{};
+    auto queryNames  = std::vector<std::string>{}; // only needed for the slow query log
+    auto loadQueries = [&](std::filesystem::path const& path) {
+        forEachSequenceRecord(path, [&](auto const& record) {
+            totalSize += record.seq.size();
+            if (cliSlowQueries) {
+                queryNames.emplace_back(record.id);
+            }
+            auto query = queryBuffer.append(record.seq.size());
+            ivs::convert_char_to_rank<Alphabet>(record.seq, query);
+            if (auto pos = ivs::verify_rank(query); pos) {
+                throw error_fmt{"query '{}' ({}) has invalid character at position {} '{}'({:x})", record.id, queryBuffer.size(), *pos, record.seq[*pos], record.seq[*pos]};
+            }
+            if (!cliNoReverse) {
+                appendReverseComplement<Alphabet>(queryBuffer);
+            }
+        });
+    };
+    // keeps the first n queries, and the names of their records
+    auto truncateQueries = [&](size_t n) {
+        queryBuffer.truncate(n);
+        if (cliSlowQueries) {
+            auto perRecord = cliNoReverse?1:2;
+            queryNames.resize(std::min(queryNames.size(), (queryBuffer.size() + perRecord - 1) / perRecord));
+        }
+    };
+    loadQueries(*cliQuery);
     if (cliLimitQueries) {
-        queries.resize(std::min(*cliLimitQueries, queries.size()));
+        truncateQueries(*cliLimitQueries);
     }
-    if (queries.empty()) {
+    if (queryBuffer.empty()) {
         throw error_fmt{"query file {} was empty - abort\n", *cliQuery};
     }
-    timing.emplace_back("ld queries", stopWatch.reset());
+
+    // paired-end reads: the queries of the second mates follow the queries of the first mates
+    auto mateQueries = queryBuffer.size(); // queries of the first mates
+    if (cliMates) {
+        if (cliNoReverse) {
+            throw error_fmt{"--mates requires the reverse complements, --no-reverse is not supported"};
+        }
+        if (cliLongReads) {
+            throw error_fmt{"--mates is not supported together with --long_reads"};
+        }
+        mateQueries = mateQueries / 2 * 2; // --limit_queries might have cut a record
+        truncateQueries(mateQueries);
+        loadQueries(*cliMates);
+        if (queryBuffer.size() < 2 * mateQueries || (!cliLimitQueries && queryBuffer.size() != 2 * mateQueries)) {
+            throw error_fmt{"query files {} and {} have a different number of records", *cliQuery, *cliMates};
+        }
+        truncateQueries(2 * mateQueries);
+    }
+    // views into the query buffer, which are handed to the search engines
+    auto queries = queryBuffer.sequences();
+
+    // long reads are searched as segments of equal length, the queries are the segments
+    auto segments = std::optional<ReadSegments>{};
+    if (cliLongReads) {
+        if (cliSlowQueries) {
+            throw error_fmt{"--slow_queries is not supported together with --long_reads"};
+        }
+        if (*cliSegmentLength == 0) {
+            throw error_fmt{"--segment_length must be larger than 0"};
+        }
+        segments.emplace(queries, *cliSegmentLength, *cliSegmentStride);
+        if (segments->segments.empty()) {
+            throw error_fmt{"no read of {} is at least {} long (--segment_length)", *cliQuery, *cliSegmentLength};
+        }
+        queries = segments->segments;
+    }
+    timing.push_back(profiler.stage("ld queries", stopWatch));
+
+    /* without an explicit generator, the configuration measured by `sahara tune` is used,
+     * tune only measures ng24 searching all hits, other workloads keep the defaults
+     */
+    auto generatorName    = *cliGenerator;
+    auto dynamicExpansion = (bool)cliDynGenerator;
+    auto tunedBy          = std::string{"-"};
+    auto tunedWorkload    = *cliSearchMode == SearchMode::All && (*cliEngine == Engine::Auto || *cliEngine == Engine::Ng24);
+    if (!cliGenerator && !cliDynGenerator && tunedWorkload) {
+        auto profilePath = TuningProfile::path(*cliIndex);
+        auto metric      = *cliDistanceMetric == DistanceMetric::Levenshtein ? "lev" : "ham";
+        if (auto entry = TuningProfile::load(profilePath).find(*cliNumErrors, queries[0].size(), metric)) {
+            generatorName    = entry->generator;
+            dynamicExpansion = entry->dynamic;
+            tunedBy          = fmt::format("{} (length {})", profilePath, entry->length);
+        }
+    }
 
 
     fmt::print(
@@ -137,154 +542,971 @@ void runSearch() {
         "  index:               {}\n"
         "  generator:           {}\n"
         "  dynamic expansion:   {}\n"
+        "  tuning profile:      {}\n"
         "  allowed errors:      {}\n"
         "  reverse complements: {}\n"
         "  search mode:         {}\n"
         "  max hits:            {}\n"
         "  output path:         {}\n",
-        *cliQuery, *cliIndex, *cliGenerator, (bool)cliDynGenerator, *cliNumErrors, !cliNoReverse,
+        *cliQuery, *cliIndex, generatorName, dynamicExpansion, tunedBy, *cliNumErrors, !cliNoReverse,
         (*cliSearchMode == SearchMode::BestHits?"besthits":"all"), *cliMaxHits,
         *cliOutput);
 
 
     {
-        auto fwdQueries = queries.size() / (cliNoReverse?1:2);
-        auto bwdQueries = queries.size() - fwdQueries;
+        auto fwdQueries = queryBuffer.size() / (cliNoReverse?1:2);
+        auto bwdQueries = queryBuffer.size() - fwdQueries;
         fmt::print("fwd queries: {}\n"
                    "bwd queries: {}\n",
                    fwdQueries, bwdQueries);
     }
+    if (cliMates) {
+        fmt::print("paired-end:\n"
+                   "  mates:               {}\n"
+                   "  pairs:               {}\n"
+                   "  rescue reference:    {}\n",
+                   *cliMates, mateQueries / 2, cliReference ? cliReference->string() : std::string{"-"});
+    }
+    if (segments) {
+        fmt::print("long reads:\n"
+                   "  segments:            {}\n"
+                   "  segment length:      {}\n"
+                   "  segment stride:      {}\n"
+                   "  skipped reads:       {}\n",
+                   segments->segments.size(), segments->segmentLength, segments->stride, segments->skipped);
+    }
 
     if (!std::filesystem::exists(*cliIndex)) {
         throw error_fmt{"no valid index path at {}", *cliIndex};
     }
 
-    auto index = fmc::BiFMIndex<Sigma, fmc::string::InterleavedBitvector16>{};
-    {
-        auto ifs     = std::ifstream{*cliIndex, std::ios::binary};
+    auto manifest = IndexManifest::load(*cliIndex);
+
+    // references hits are reported on (all if empty), indexed by global id
+    auto restrictRefs = std::vector<bool>{};
+    if (cliRestrictRefs) {
+        auto names = std::filesystem::exists(ReferenceNames::path(*cliIndex)) ? ReferenceNames::load(ReferenceNames::path(*cliIndex)) : ReferenceNames{};
+        auto ids   = names.resolve(*cliRestrictRefs);
+        if (ids.empty()) {
+            throw error_fmt{"--restrict-refs lists no reference"};
+        }
+        auto refCount = manifest.refCount() > 0 ? manifest.refCount() : names.names.size();
+        for (auto id : ids) {
+            if (refCount > 0 && id >= refCount) {
+                throw error_fmt{"reference id {} is out of range, the index has {} references", id, refCount};
+            }
+            restrictRefs.resize(std::max(restrictRefs.size(), id+1));
+            restrictRefs[id] = true;
+        }
+        fmt::print("restricted references: {}\n", std::ranges::count(restrictRefs, true));
+    }
+    auto isRestricted = [&](size_t refId) {
+        return !restrictRefs.empty() && (refId >= restrictRefs.size() || !restrictRefs[refId]);
+    };
+    /* Hits on excluded references are only dropped while locating. Restricted
+     * searches therefore collect all hits up to k errors without a per query
+     * limit, best hits and --max_hits are applied to the remaining hits.
+     */
+    auto allHits       = *cliSearchMode == SearchMode::All || !restrictRefs.empty();
+    auto engineMaxHits = restrictRefs.empty() ? *cliMaxHits : size_t{0};
+    // a shard is only searched if it contains one of the restricted references
+    auto shardSearched = [&](IndexManifest::Segment const& segment) {
+        for (size_t id{segment.firstRefId}; id < segment.firstRefId + segment.refCount; ++id) {
+            if (!isRestricted(id)) return true;
+        }
+        return false;
+    };
+    auto loadIndex = [&](IndexManifest::Segment const& segment) {
+        auto index   = Index{};
+        auto ifs     = std::ifstream{IndexManifest::segmentPath(*cliIndex, segment), std::ios::binary};
         auto archive = cereal::BinaryInputArchive{ifs};
         size_t sigma;
         archive(sigma);
+        if (sigma != Sigma) {
+            throw error_fmt{"index segment {} has {} letters, expected {}", segment.path, sigma, Sigma};
+        }
         archive(index);
+        return index;
+    };
+
+    // a single index is loaded up front, it is required to know its size
+    auto singleIndex = std::optional<Index>{};
+    auto indexSize   = manifest.indexSize();
+    if (manifest.segments.size() == 1) {
+        singleIndex = loadIndex(manifest.segments[0]);
+        indexSize   = singleIndex->size();
+        timing.push_back(profiler.stage("ld index", stopWatch));
+    } else {
+        fmt::print("shards: {}\n"
+                   "shard threads: {}\n"
+                   "shard memory: {}MB\n",
+                   manifest.segments.size(), *cliShardThreads, *cliShardMemory);
     }
-    timing.emplace_back("ld index", stopWatch.reset());
 
     auto k = *cliNumErrors;
 
     auto generator = [&]() {
-        auto iter = fmc::search_scheme::generator::all.find(*cliGenerator);
+        auto iter = fmc::search_scheme::generator::all.find(generatorName);
         if (iter == fmc::search_scheme::generator::all.end()) {
             auto names = std::vector<std::string>{};
             for (auto const& [key, gen] : fmc::search_scheme::generator::all) {
                 names.push_back(key);
             }
-            throw error_fmt{"unknown search scheme generetaror \"{}\", valid generators are: {}", *cliGenerator, fmt::join(names, ", ")};
+            throw error_fmt{"unknown search scheme generetaror \"{}\", valid generators are: {}", generatorName, fmt::join(names, ", ")};
         }
         return iter->second.generator;
     }();
 
+    // q-gram statistics of the reference (sahara index --qgram_stats) replace the uniform text model of the dynamic expansion
+    auto qgramStats = std::optional<QGramStats>{};
+    if (dynamicExpansion && std::filesystem::exists(QGramStats::path(*cliIndex))) {
+        qgramStats = QGramStats::load(QGramStats::path(*cliIndex));
+        fmt::print("reference model: {} (q = {})\n", QGramStats::path(*cliIndex), qgramStats->q());
+    }
+
+    auto engine = selectEngine(*cliEngine, *cliSearchMode, *cliDistanceMetric);
+    fmt::print("engine: {}{}\n", engineName(engine), *cliEngine == Engine::Auto ? " (auto)" : "");
+
+    // exact matching (k=0, or the first best hits level) uses plain backward search, unless an engine was requested
+    auto exactPath = *cliEngine == Engine::Auto && !cliNoExactPath && (k == 0 || !allHits);
+    if (exactPath) {
+        fmt::print("exact path: {}\n", k == 0 ? "all queries" : "first best hits level");
+    }
+
+    // unexpanded scheme and its partition, starting point of the adaptive partitions
+    auto baseScheme    = decltype(generator(0, k, 0, 0)){};
+    auto basePartition = std::vector<size_t>{};
+
     auto loadSearchScheme = [&](int minK, int maxK, bool edit) {
         auto len = queries[0].size();
         auto oss = generator(minK, maxK, /*unused*/0, /*unused*/0);
-        if (edit) {
-            if (!cliDynGenerator) {
+        baseScheme = oss;
+        auto expandScheme = [&]<bool Edit>() {
+            if (!dynamicExpansion) {
+                basePartition = fmc::search_scheme::expandCount(oss[0].pi.size(), len);
                 oss = fmc::search_scheme::expand(oss, len);
+            } else if (qgramStats) {
+                auto partition = reference_model::optimizeCounts<Edit>(oss, len, *qgramStats);
+                fmt::print("partition: {}\n", partition);
+                basePartition = partition;
+                oss = fmc::search_scheme::expand(oss, partition);
             } else {
-                auto partition = optimizeByWNCTopDown</*Edit=*/true>(oss, len, Sigma, index.size(), 1);
+                auto partition = optimizeByWNCTopDown<Edit>(oss, len, Sigma, indexSize, 1);
                 fmt::print("partition: {}\n", partition);
-                oss = fmc::search_scheme::expandByWNCTopDown</*Edit=*/true>(oss, len, Sigma, index.size(), 1);
+                basePartition.assign(partition.begin(), partition.end());
+                oss = fmc::search_scheme::expandByWNCTopDown<Edit>(oss, len, Sigma, indexSize, 1);
+            }
+            fmt::print("node count: {}\n", fmc::search_scheme::nodeCount<Edit>(oss, Sigma));
+            fmt::print("weighted node count: {}\n", fmc::search_scheme::weightedNodeCount<Edit>(oss, Sigma, indexSize));
+            if (qgramStats) {
+                fmt::print("reference weighted node count: {}\n", reference_model::weightedNodeCount<Edit>(oss, *qgramStats));
+            }
+        };
+        if (edit) expandScheme.template operator()</*Edit=*/true>();
+        else      expandScheme.template operator()</*Edit=*/false>();
+        return oss;
+    };
+
+    bool Edit = *cliDistanceMetric == DistanceMetric::Levenshtein;
+    auto search_scheme  = decltype(loadSearchScheme(0, k, Edit)){};
+    auto search_schemes = std::vector<decltype(search_scheme)>{};
+    if (allHits) {
+        search_scheme = loadSearchScheme(0, k, Edit);
+        if (!Edit) {
+            search_scheme = limitToHamming(search_scheme);
+        }
+    } else {
+        for (size_t j{0}; j<=k; ++j) {
+            search_schemes.emplace_back(loadSearchScheme(j, j, Edit));
+            if (!Edit) {
+                search_schemes.back() = limitToHamming(search_schemes.back());
+            }
+        }
+    }
+
+    // alternative expansions, every query is searched with the one fitting its composition
+    auto adaptive        = std::optional<AdaptivePartitions>{};
+    auto adaptiveSchemes = std::vector<decltype(search_scheme)>{};
+    auto adaptiveUsage   = std::vector<size_t>{}; // queries per partition, summed over all shards
+    if (cliAdaptivePartition) {
+        if (*cliSearchMode != SearchMode::All) {
+            throw error_fmt{"--adaptive_partition requires search mode all"};
+        }
+        adaptive.emplace(baseScheme, basePartition);
+        for (auto const& partition : adaptive->partitions) {
+            auto scheme = fmc::search_scheme::expand(baseScheme, partition);
+            if (!Edit) {
+                scheme = limitToHamming(scheme);
+            }
+            adaptiveSchemes.emplace_back(std::move(scheme));
+        }
+        adaptiveSchemes[0] = search_scheme; // the base partition is the regular expansion
+        adaptiveUsage.resize(adaptiveSchemes.size());
+        fmt::print("adaptive partitions: {}\n", fmt::join(adaptive->partitions, ", "));
+    }
+    timing.push_back(profiler.stage("searchScheme", stopWatch));
+
+    auto hitBufferBytes = std::atomic<size_t>{}; // summed over all shards
+    auto discardedHits  = std::atomic<size_t>{}; // located hits on references excluded by --restrict-refs
+
+    // per query latency in ticks of readCycleCounter(), hits and expanded nodes, summed over all shards
+    auto queryTicks     = std::vector<uint64_t>(measureLatency?queries.size():0);
+    auto queryHits      = std::vector<uint64_t>(measureLatency?queries.size():0);
+    auto queryNodes     = std::vector<uint64_t>(measureLatency?queries.size():0);
+    auto latencyTicks   = uint64_t{}; // ticks and seconds of all per query searches, to convert ticks into seconds
+    auto latencySeconds = double{};
+    auto latencyMutex   = std::mutex{};
+
+    // search tree statistics summed over all shards, only used if Instrumented
+    auto treeStats      = SearchTreeStats{};
+    auto treeStatsMutex = std::mutex{};
+
+    // runs every search of the scheme for every query on its own and measures the visited search tree
+    auto measureSearchTree = [&](Index const& index) {
+        auto stats = SearchTreeStats{};
+        auto parts = std::vector<decltype(search_scheme)>{};
+        auto addPart = [&](std::string label, auto const& search) {
+            parts.push_back({search});
+            auto predicted = Edit ? fmc::search_scheme::weightedNodeCount</*Edit=*/true>(parts.back(), Sigma, indexSize)
+                                  : fmc::search_scheme::weightedNodeCount</*Edit=*/false>(parts.back(), Sigma, indexSize);
+            stats.searches.push_back({std::move(label), size_t(search.l.back()), size_t(search.u.back()), double(predicted), {}});
+        };
+        if (allHits) {
+            for (size_t i{0}; i < search_scheme.size(); ++i) {
+                addPart(fmt::format("search {}", i), search_scheme[i]);
             }
-            fmt::print("node count: {}\n", fmc::search_scheme::nodeCount</*Edit=*/true>(oss, Sigma));
-            fmt::print("weighted node count: {}\n", fmc::search_scheme::weightedNodeCount</*Edit=*/true>(oss, Sigma, index.size()));
         } else {
-            if (!cliDynGenerator) {
-                oss = fmc::search_scheme::expand(oss, len);
-            } else {
-                auto partition = optimizeByWNCTopDown</*Edit=*/false>(oss, len, Sigma, index.size(), 1);
-                fmt::print("partition: {}\n", partition);
-                oss = fmc::search_scheme::expandByWNCTopDown</*Edit=*/false>(oss, len, Sigma, index.size(), 1);
+            // besthits stops after the first level with hits, here every level is explored
+            for (size_t j{0}; j < search_schemes.size(); ++j) {
+                for (size_t i{0}; i < search_schemes[j].size(); ++i) {
+                    addPart(fmt::format("level {} search {}", j, i), search_schemes[j][i]);
+                }
             }
-            fmt::print("node count: {}\n", fmc::search_scheme::nodeCount</*Edit=*/false>(oss, Sigma));
-            fmt::print("weighted node count: {}\n", fmc::search_scheme::weightedNodeCount</*Edit=*/false>(oss, Sigma, index.size()));
+        }
 
+        auto ignoreHits = [](size_t, auto const&, size_t) {};
+        for (auto const& query : queries) {
+            auto single      = std::array{query};
+            auto queryCounts = SearchTreeStats::Counts{};
+            auto levelCounts = std::map<size_t, SearchTreeStats::Counts>{};
+            for (size_t i{0}; i < parts.size(); ++i) {
+                auto before = SearchTreeStats::snapshot();
+                if (Edit) fmc::search_ng24::search</*Edit=*/true> (index, single, parts[i], ignoreHits);
+                else      fmc::search_ng24::search</*Edit=*/false>(index, single, parts[i], ignoreHits);
+                auto counts = SearchTreeStats::delta(before);
+                stats.searches[i].measured.add(counts);
+                queryCounts.add(counts);
+                levelCounts[stats.searches[i].maxErrors].add(counts);
+            }
+            queryCounts.queries = 1;
+            stats.buckets[query.size() / SearchTreeStats::BucketWidth * SearchTreeStats::BucketWidth].add(queryCounts);
+            for (auto& [level, counts] : levelCounts) {
+                counts.queries = 1;
+                stats.levels[level].add(counts);
+            }
         }
-        return oss;
+        return stats;
     };
 
-    auto resultCursors = std::vector<std::tuple<size_t, fmc::LeftBiFMIndexCursor<decltype(index)>, size_t>>{};
+    // Searches all queries inside a single index, reported seqIds are shifted by firstRefId
+    auto searchIndex = [&](Index const& index, size_t firstRefId, std::vector<std::tuple<std::string, double>>& stageTiming) {
+        auto stageWatch = StopWatch();
+        auto stats = SearchTreeStats{};
+        if constexpr (Instrumented) {
+            stats = measureSearchTree(index);
+            stageTiming.push_back(profiler.stage("measure tree", stageWatch));
+        }
 
+        // partition of every query, chosen by the q-gram counts of this index
+        auto choice = std::vector<size_t>{};
+        if (adaptive) {
+            auto table = QGramCountTable<Sigma>{index};
+            choice.resize(queries.size());
+            auto usage = std::vector<size_t>(adaptiveSchemes.size());
+            for (size_t q{0}; q < queries.size(); ++q) {
+                choice[q] = adaptive->choose(queries[q], table);
+                usage[choice[q]] += 1;
+            }
+            {
+                auto lock = std::unique_lock{latencyMutex};
+                for (size_t i{0}; i < usage.size(); ++i) {
+                    adaptiveUsage[i] += usage[i];
+                }
+            }
+            stageTiming.push_back(profiler.stage("partition", stageWatch));
+        }
 
-    bool Edit = *cliDistanceMetric == DistanceMetric::Levenshtein;
-    auto res_cb = [&](size_t queryId, auto const& cursor, size_t errors) {
-        resultCursors.emplace_back(queryId, cursor, errors);
-    };
-    if (*cliSearchMode == SearchMode::All) {
-        auto search_scheme  = loadSearchScheme(0, k, Edit);
-        timing.emplace_back("searchScheme", stopWatch.reset());
+        // exact matches by backward search with a q-gram table, replaces the engine for k=0 and the first best hits level
+        auto exactSearch = std::optional<ExactSearch<Sigma, Index>>{};
+        if (exactPath) {
+            exactSearch.emplace(index);
+            stageTiming.push_back(profiler.stage("exact table", stageWatch));
+        }
+        auto rankCallsBefore = search_tree_stats::rankCalls;
 
-        if (!Edit) {
-            search_scheme = limitToHamming(search_scheme);
-            if (*cliMaxHits == 0) fmc::search_ng24::search<false>  (index, queries, search_scheme, res_cb);
-            else                  fmc::search_ng24::search_n<false>(index, queries, search_scheme, *cliMaxHits, res_cb);
+        // searches the queries [begin, end) into its own hit buffer
+        auto searchRange = [&](size_t begin, size_t end, HitBuffer& hits) {
+            auto queryOffset = begin;                // id of the first query handed to the engine
+            auto queryIds    = std::span<size_t const>{}; // ids of the queries handed to the engine, if not consecutive
+            auto res_cb = [&](size_t queryId, auto const& cursor, size_t errors) {
+                hits.push(queryIds.empty() ? queryOffset + queryId : queryIds[queryId], cursor.lb, cursor.len, errors);
+            };
+            // searches with a single scheme, reporting all hits
+            auto runAll = [&](auto const& queries, auto const& search_scheme, auto& cb) {
+                switch (engine) {
+                case Engine::Auto:
+                case Engine::Ng24:
+                    if (!Edit) {
+                        if (engineMaxHits == 0) fmc::search_ng24::search<false>  (index, queries, search_scheme, cb);
+                        else                    fmc::search_ng24::search_n<false>(index, queries, search_scheme, engineMaxHits, cb);
+                    } else {
+                        if (engineMaxHits == 0) fmc::search_ng24::search<true>  (index, queries, search_scheme, cb);
+                        else                    fmc::search_ng24::search_n<true>(index, queries, search_scheme, engineMaxHits, cb);
+                    }
+                    break;
+                case Engine::Ng21:
+                    if (engineMaxHits == 0) fmc::search_ng21::search  (index, queries, search_scheme, cb);
+                    else                    fmc::search_ng21::search_n(index, queries, search_scheme, engineMaxHits, cb);
+                    break;
+                case Engine::Pseudo:
+                    if (!Edit) fmc::search_pseudo::search</*Edit=*/false>(index, queries, search_scheme, cb);
+                    else       fmc::search_pseudo::search</*Edit=*/true> (index, queries, search_scheme, cb);
+                    break;
+                case Engine::Backtracking:
+                    fmc::search_backtracking::search(index, queries, size_t(search_scheme[0].u.back()), cb);
+                    break;
+                }
+            };
+            auto runExact = [&](auto const& queries, auto& cb) {
+                if (engineMaxHits == 0) {
+                    exactSearch->search(queries, cb);
+                } else {
+                    exactSearch->search(queries, [&](size_t queryId, auto cursor, size_t errors) {
+                        cursor.len = std::min<size_t>(cursor.len, engineMaxHits);
+                        cb(queryId, cursor, errors);
+                    });
+                }
+            };
+            // searches the queries `pending` (indices into queries) level by level, starting at firstLevel
+            auto runLevels = [&](auto const& queries, std::vector<size_t> pending, size_t firstLevel) {
+                auto outerIds = std::vector<size_t>(queries.size());
+                for (size_t q{0}; q < queries.size(); ++q) {
+                    outerIds[q] = queryIds.empty() ? queryOffset + q : queryIds[q];
+                }
+                auto savedIds = queryIds;
+                for (size_t j{firstLevel}; j < search_schemes.size() && !pending.empty(); ++j) {
+                    auto ids   = std::vector<size_t>{};
+                    auto group = std::vector<std::span<uint8_t const>>{};
+                    for (auto q : pending) {
+                        ids.push_back(outerIds[q]);
+                        group.push_back(queries[q]);
+                    }
+                    auto found = std::vector<bool>(group.size());
+                    auto level_cb = [&](size_t queryId, auto const& cursor, size_t errors) {
+                        found[queryId] = true;
+                        res_cb(queryId, cursor, errors);
+                    };
+                    queryIds = ids;
+                    if (j == 0 && exactSearch) {
+                        runExact(group, level_cb);
+                    } else if (engine == Engine::Ng21) {
+                        // ng21 searches all remaining levels itself
+                        auto levels = std::vector(search_schemes.begin() + j, search_schemes.end());
+                        if (engineMaxHits == 0) fmc::search_ng21::search_best  (index, group, levels, res_cb);
+                        else                    fmc::search_ng21::search_best_n(index, group, levels, engineMaxHits, res_cb);
+                        break;
+                    } else {
+                        runAll(group, search_schemes[j], level_cb);
+                    }
+                    auto next = std::vector<size_t>{};
+                    for (size_t i{0}; i < pending.size(); ++i) {
+                        if (!found[i]) next.push_back(pending[i]);
+                    }
+                    pending = std::move(next);
+                }
+                queryIds = savedIds;
+            };
+            auto runEngine = [&](auto const& queries, auto const& search_scheme) {
+                if (allHits) {
+                    if (exactSearch) runExact(queries, res_cb);
+                    else             runAll(queries, search_scheme, res_cb);
+                } else if (engine == Engine::Ng21 && !exactSearch) {
+                    if (engineMaxHits == 0) fmc::search_ng21::search_best  (index, queries, search_schemes, res_cb);
+                    else                    fmc::search_ng21::search_best_n(index, queries, search_schemes, engineMaxHits, res_cb);
+                } else {
+                    // the next error level only searches the queries without hits
+                    auto pending = std::vector<size_t>(queries.size());
+                    std::iota(pending.begin(), pending.end(), 0);
+                    runLevels(queries, std::move(pending), 0);
+                }
+            };
+            if (!measureLatency && adaptive) {
+                // queries sharing a partition are searched together
+                for (size_t i{0}; i < adaptiveSchemes.size(); ++i) {
+                    auto ids   = std::vector<size_t>{};
+                    auto group = std::vector<std::span<uint8_t const>>{};
+                    for (size_t q{begin}; q < end; ++q) {
+                        if (choice[q] != i) continue;
+                        ids.push_back(q);
+                        group.push_back(queries[q]);
+                    }
+                    if (group.empty()) continue;
+                    queryIds = ids;
+                    runEngine(group, adaptiveSchemes[i]);
+                }
+                queryIds = {};
+            } else if (!measureLatency) {
+                runEngine(std::vector(queries.begin() + begin, queries.begin() + end), search_scheme);
+            } else {
+                // only searched on a single thread, [begin, end) covers all queries
+                auto ticks = std::vector<uint64_t>(queries.size());
+                auto found = std::vector<uint64_t>(queries.size());
+                auto nodes = std::vector<uint64_t>(queries.size());
+                auto loopWatch = StopWatch();
+                auto loopStart = readCycleCounter();
+                for (size_t q{0}; q < queries.size(); ++q) {
+                    auto single      = std::array{queries[q]};
+                    auto rowsBefore  = hits.rows();
+                    auto nodesBefore = search_tree_stats::allRankCalls;
+                    queryOffset = q;
+                    auto start = readCycleCounter();
+                    runEngine(single, adaptive ? adaptiveSchemes[choice[q]] : search_scheme);
+                    ticks[q] = readCycleCounter() - start;
+                    found[q] = hits.rows() - rowsBefore;
+                    nodes[q] = (search_tree_stats::allRankCalls - nodesBefore) / 2;
+                }
+                auto loopTicks = readCycleCounter() - loopStart;
+                auto lock = std::unique_lock{latencyMutex};
+                for (size_t q{0}; q < queries.size(); ++q) {
+                    queryTicks[q] += ticks[q];
+                    queryHits[q]  += found[q];
+                    queryNodes[q] += nodes[q];
+                }
+                latencyTicks   += loopTicks;
+                latencySeconds += loopWatch.peek();
+            }
+        };
+
+        // per query measurements rely on global counters, they are searched on a single thread
+        auto threadNbr  = (measureLatency || Instrumented) ? size_t{1} : std::max(size_t{1}, std::min(*cliThreads, queries.size()));
+        auto hitBuffers = std::vector<HitBuffer>(threadNbr);
+        if (threadNbr == 1) {
+            searchRange(0, queries.size(), hitBuffers[0]);
         } else {
-            if (*cliMaxHits == 0) fmc::search_ng24::search<true>  (index, queries, search_scheme, res_cb);
-            else                  fmc::search_ng24::search_n<true>(index, queries, search_scheme, *cliMaxHits, res_cb);
+            auto error   = std::exception_ptr{};
+            auto mutex   = std::mutex{};
+            auto threads = std::vector<std::thread>{};
+            for (size_t i{0}; i < threadNbr; ++i) {
+                threads.emplace_back([&, i]() {
+                    profiler.setThreadName(fmt::format("search worker {}", i));
+                    auto workerWatch = StopWatch();
+                    try {
+                        searchRange(queries.size() * i / threadNbr, queries.size() * (i+1) / threadNbr, hitBuffers[i]);
+                    } catch (...) {
+                        auto lock = std::unique_lock{mutex};
+                        if (!error) error = std::current_exception();
+                    }
+                    // the work of this thread, its perf counters are added to the search stage
+                    profiler.stage("search", workerWatch);
+                });
+            }
+            for (auto& t : threads) {
+                t.join();
+            }
+            if (error) {
+                std::rethrow_exception(error);
+            }
         }
+        stageTiming.push_back(profiler.stage("search", stageWatch));
+        stats.searchRankCalls = search_tree_stats::rankCalls - rankCallsBefore;
+        rankCallsBefore       = search_tree_stats::rankCalls;
+
+        auto hitIntervals = size_t{};
+        auto hitRows      = size_t{};
+        for (auto const& hits : hitBuffers) {
+            hitIntervals += hits.size();
+            hitRows      += hits.rows();
+        }
+        auto results   = std::vector<Result>{};
+        auto discarded = size_t{};
+        if (restrictRefs.empty()) {
+            results.reserve(hitRows);
+            for (auto const& hits : hitBuffers) {
+                hits.forEach([&](size_t queryId, size_t lb, size_t len, size_t e) {
+                    for (size_t row{lb}; row < lb + len; ++row) {
+                        auto [sae, offset] = index.locate(row);
+                        auto [seqId, seqPos] = sae;
+                        results.emplace_back(queryId, seqId + firstRefId, seqPos+offset, e);
+                    }
+                });
+                hitBufferBytes += hits.bytes();
+            }
+        } else {
+            /* intervals of every query by increasing errors, located until
+             * --max_hits hits on restricted references are found, with best
+             * hits only in the error level of the first one
+             */
+            auto intervals = std::vector<std::tuple<size_t, size_t, size_t, size_t>>{}; // queryId, errors, lb, len
+            intervals.reserve(hitIntervals);
+            for (auto const& hits : hitBuffers) {
+                hits.forEach([&](size_t queryId, size_t lb, size_t len, size_t e) {
+                    intervals.emplace_back(queryId, e, lb, len);
+                });
+                hitBufferBytes += hits.bytes();
+            }
+            std::ranges::sort(intervals);
+            auto bestHits = *cliSearchMode == SearchMode::BestHits;
+            for (size_t i{0}; i < intervals.size();) {
+                auto queryId   = std::get<0>(intervals[i]);
+                auto accepted  = size_t{};
+                auto minErrors = size_t{};
+                for (; i < intervals.size() && std::get<0>(intervals[i]) == queryId; ++i) {
+                    auto [id, e, lb, len] = intervals[i];
+                    if (*cliMaxHits > 0 && accepted == *cliMaxHits) continue;
+                    if (bestHits && accepted > 0 && e > minErrors) continue;
+                    for (size_t row{lb}; row < lb + len && (*cliMaxHits == 0 || accepted < *cliMaxHits); ++row) {
+                        auto [sae, offset] = index.locate(row);
+                        auto [seqId, seqPos] = sae;
+                        if (isRestricted(seqId + firstRefId)) {
+                            discarded += 1;
+                            continue;
+                        }
+                        results.emplace_back(queryId, seqId + firstRefId, seqPos+offset, e);
+                        if (accepted == 0) minErrors = e;
+                        accepted += 1;
+                    }
+                }
+            }
+        }
+        profiler.count("hit intervals", hitIntervals);
+        profiler.count("located hits", results.size());
+        if (!restrictRefs.empty()) {
+            profiler.count("discarded hits", discarded);
+            discardedHits += discarded;
+        }
+        if constexpr (Instrumented) {
+            stats.locateRows      = hitRows;
+            stats.locateRankCalls = search_tree_stats::rankCalls - rankCallsBefore;
+            profiler.count("search rank calls", stats.searchRankCalls);
+            profiler.count("locate rank calls", stats.locateRankCalls);
+            auto lock = std::unique_lock{treeStatsMutex};
+            treeStats.add(stats);
+        }
+        stageTiming.push_back(profiler.stage("locate", stageWatch));
+        return results;
+    };
+
+    auto skippedShards = size_t{};
+    auto skippedBytes  = size_t{};
+    auto results = std::vector<Result>{};
+    if (singleIndex) {
+        auto stageTiming = std::vector<std::tuple<std::string, double>>{};
+        results = searchIndex(*singleIndex, 0, stageTiming);
+        timing.insert(timing.end(), stageTiming.begin(), stageTiming.end());
+        stopWatch.reset();
     } else {
-        auto search_schemes = std::vector<decltype(loadSearchScheme(0, k, Edit))>{};
-        for (size_t j{0}; j<=k; ++j) {
-            search_schemes.emplace_back(loadSearchScheme(j, j, Edit));
+        auto shardResults = std::vector<std::vector<Result>>(manifest.segments.size());
+        auto shardTiming  = std::vector<std::vector<std::tuple<std::string, double>>>(manifest.segments.size());
+
+        auto threadNbr   = std::max(size_t{1}, std::min(*cliShardThreads, manifest.segments.size()));
+        auto memoryLimit = *cliShardMemory * 1024 * 1024;
+
+        // shards are loaded in order, as long as they fit into the memory limit
+        auto mutex          = std::mutex{};
+        auto cv             = std::condition_variable{};
+        auto nextShard      = size_t{};
+        auto residentBytes  = size_t{};
+        auto residentShards = size_t{};
+        auto error          = std::exception_ptr{};
+        auto shardSkipped   = std::vector<bool>(manifest.segments.size()); // by --restrict-refs, neither loaded nor searched
+
+        auto worker = [&]() {
+            try {
+                while (true) {
+                    auto shard = size_t{};
+                    auto fileSize = size_t{};
+                    {
+                        auto lock = std::unique_lock{mutex};
+                        if (nextShard == manifest.segments.size() || error) return;
+                        shard    = nextShard++;
+                        fileSize = manifest.segments[shard].fileSize;
+                        if (!shardSearched(manifest.segments[shard])) {
+                            shardSkipped[shard] = true;
+                            continue;
+                        }
+                        cv.wait(lock, [&]() {
+                            return memoryLimit == 0 || residentShards == 0 || residentBytes + fileSize <= memoryLimit;
+                        });
+                        residentBytes  += fileSize;
+                        residentShards += 1;
+                    }
+                    auto const& segment = manifest.segments[shard];
+                    auto shardWatch = StopWatch();
+                    {
+                        auto scope = Profiler::Scope{fmt::format("shard {}", shard)};
+                        auto index = loadIndex(segment);
+                        shardTiming[shard].push_back(profiler.stage("ld index", shardWatch));
+                        shardResults[shard] = searchIndex(index, segment.firstRefId, shardTiming[shard]);
+                    }
+                    {
+                        auto lock = std::unique_lock{mutex};
+                        residentBytes  -= fileSize;
+                        residentShards -= 1;
+                    }
+                    cv.notify_all();
+                }
+            } catch (...) {
+                auto lock = std::unique_lock{mutex};
+                if (!error) error = std::current_exception();
+            }
+        };
+
+        auto threads = std::vector<std::thread>{};
+        for (size_t i{1}; i < threadNbr; ++i) {
+            threads.emplace_back([&, i]() {
+                profiler.setThreadName(fmt::format("shard worker {}", i));
+                worker();
+            });
+        }
+        worker();
+        for (auto& t : threads) {
+            t.join();
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+
+        for (size_t i{0}; i < manifest.segments.size(); ++i) {
+            if (shardSkipped[i]) {
+                fmt::print("shard {}: skipped, no restricted reference\n", i);
+                skippedShards += 1;
+                skippedBytes  += manifest.segments[i].fileSize;
+                continue;
+            }
+            fmt::print("shard {}:", i);
+            for (auto const& [key, time] : shardTiming[i]) {
+                fmt::print(" {} {:.2f}s", key, time);
+            }
+            fmt::print(", hits {}\n", shardResults[i].size());
         }
-        timing.emplace_back("searchScheme", stopWatch.reset());
-        if (*cliMaxHits == 0) fmc::search_ng21::search_best  (index, queries, search_schemes, res_cb);
-        else                  fmc::search_ng21::search_best_n(index, queries, search_schemes, *cliMaxHits, res_cb);
+
+        if (threadNbr == 1) {
+            // sequential run, stage times add up to the wall time
+            for (auto const& key : {"ld index", "measure tree", "partition", "exact table", "search", "locate"}) {
+                if (!Instrumented && key == std::string_view{"measure tree"}) continue;
+                if (!adaptive && key == std::string_view{"partition"}) continue;
+                double time{};
+                for (auto const& st : shardTiming) {
+                    for (auto const& [name, t] : st) {
+                        if (name == key) time += t;
+                    }
+                }
+                timing.emplace_back(key, time);
+            }
+            stopWatch.reset();
+        } else {
+            timing.push_back(profiler.stage("search shards", stopWatch));
+        }
+
+        results = mergeShardResults(shardResults, *cliSearchMode == SearchMode::BestHits, *cliMaxHits);
+        timing.push_back(profiler.stage("merge", stopWatch));
     }
-    timing.emplace_back("search", stopWatch.reset());
 
-    auto results = std::vector<std::tuple<size_t, size_t, size_t, size_t>>{};
-    for (auto const& [queryId, cursor, e] : resultCursors) {
-        for (auto [sae, offset] : fmc::LocateLinear{index, cursor}) {
-            auto [seqId, seqPos] = sae;
-            results.emplace_back(queryId, seqId, seqPos+offset, e);
+    // segment hits are chained into read mappings, chains[read] best first
+    auto chains      = std::vector<std::vector<chaining::Chain>>{};
+    auto mappedReads  = size_t{};
+    if (segments) {
+        auto params = chaining::Parameters {
+            .segmentLength = segments->segmentLength,
+            .maxGap        = *cliChainMaxGap,
+            .bandwidth     = *cliChainBandwidth,
+            .minScore      = *cliMinChainScore > 0. ? *cliMinChainScore : double(segments->segmentLength + std::min(segments->stride, segments->segmentLength)),
+            .maxChains     = *cliMaxChains,
+        };
+        auto anchors = std::vector<std::vector<chaining::Anchor>>(queryBuffer.size());
+        for (auto const& [segmentId, seqId, pos, e] : results) {
+            anchors[segments->read[segmentId]].push_back({seqId, pos, segments->offset[segmentId], e});
         }
+        chains.resize(anchors.size());
+        for (size_t r{0}; r < anchors.size(); ++r) {
+            if (anchors[r].empty()) continue;
+            chains[r] = chaining::chain(anchors[r], segments->readLength[r], params);
+            anchors[r] = {};
+            mappedReads += !chains[r].empty();
+        }
+        timing.push_back(profiler.stage("chain", stopWatch));
     }
 
-    timing.emplace_back("locate", stopWatch.reset());
+    // hits of both mates are paired, pairs[record] best first
+    auto pairs       = std::vector<std::vector<paired_end::Pair>>{};
+    auto insertModel = paired_end::InsertSizeModel{};
+    auto pairCounts  = std::array<size_t, 3>{}; // proper, rescued, unpaired
+    if (cliMates) {
+        // references are only needed to verify the rescue windows
+        auto refBuffer = SequenceBuffer{};
+        if (cliReference) {
+            forEachSequenceRecord(*cliReference, [&](auto const& record) {
+                auto ref = refBuffer.append(record.seq.size());
+                ivs::convert_char_to_rank<Alphabet>(record.seq, ref);
+                if (auto pos = ivs::verify_rank(ref); pos) {
+                    throw error_fmt{"reference '{}' ({}) has invalid character at position {} '{}'({:x})", record.id, refBuffer.size(), *pos, record.seq[*pos], record.seq[*pos]};
+                }
+            });
+            // a single index file has no manifest entry with its reference count, every reference ends with one delimiter
+            auto refCount = manifest.refCount() > 0 ? manifest.refCount()
+                                                    : fmc::BiFMIndexCursor<Index>{*singleIndex}.extendLeft(0).count();
+            if (refBuffer.size() != refCount) {
+                throw error_fmt{"reference {} has {} records, the index has {}", *cliReference, refBuffer.size(), refCount};
+            }
+            timing.push_back(profiler.stage("ld reference", stopWatch));
+        }
+
+        auto records   = mateQueries / 2;
+        auto mateLen   = [&](size_t mate, size_t r) { return queries[mate * mateQueries + 2*r].size(); };
+        auto mateHits  = std::vector<std::array<std::vector<paired_end::MateHit>, 2>>(records);
+        for (auto const& [queryId, seqId, pos, e] : results) {
+            auto q = queryId % mateQueries;
+            mateHits[q / 2][queryId / mateQueries].push_back({seqId, pos, q % 2 == 1, e});
+        }
+
+        // insert sizes of the first pairs, whose mates have a single hit each
+        auto inserts = std::vector<size_t>{};
+        for (size_t r{0}; r < records && inserts.size() < *cliInsertSample; ++r) {
+            auto const& [hits1, hits2] = mateHits[r];
+            if (hits1.size() != 1 || hits2.size() != 1) continue;
+            auto insert = hits1[0].reverse ? paired_end::insertSize(hits2[0], hits1[0], mateLen(0, r))
+                                           : paired_end::insertSize(hits1[0], hits2[0], mateLen(1, r));
+            if (insert && *insert <= *cliMaxInsert) {
+                inserts.push_back(*insert);
+            }
+        }
+        insertModel = paired_end::InsertSizeModel::learn(std::move(inserts), *cliMaxInsert);
+        fmt::print("insert size: median {:.0f}, sd {:.1f}, range [{}, {}], learned from {} pairs\n",
+                   insertModel.median, insertModel.sd, insertModel.lo, insertModel.hi, insertModel.samples);
+
+        // searches the unmapped mate near the hits of the mapped one
+        auto rescue = [&](size_t r, size_t anchorMate) -> std::optional<paired_end::Pair> {
+            auto anchors = mateHits[r][anchorMate];
+            std::ranges::stable_sort(anchors, [](auto const& lhs, auto const& rhs) { return lhs.errors < rhs.errors; });
+            anchors.resize(std::min(anchors.size(), *cliRescueHits));
+            auto mate = 1 - anchorMate;
+            auto best = std::optional<paired_end::Pair>{};
+            for (auto const& a : anchors) {
+                auto text   = refBuffer[a.seqId];
+                auto [b, e] = paired_end::rescueWindow(a, mateLen(anchorMate, r), mateLen(mate, r), insertModel);
+                b = b > k ? b - k : 0;
+                e = std::min(e + k, text.size());
+                if (b >= e) continue;
+                // the mate is searched in the orientation opposite to the anchor
+                auto query = queries[mate * mateQueries + 2*r + (a.reverse ? 0 : 1)];
+                auto hit   = Edit ? paired_end::verify</*Edit=*/true> (text.subspan(b, e - b), query, k)
+                                  : paired_end::verify</*Edit=*/false>(text.subspan(b, e - b), query, k);
+                if (!hit) continue;
+                auto m = paired_end::MateHit{a.seqId, b + std::get<0>(*hit), !a.reverse, std::get<1>(*hit)};
+                auto insert = a.reverse ? paired_end::insertSize(m, a, mateLen(anchorMate, r))
+                                        : paired_end::insertSize(a, m, mateLen(mate, r));
+                if (!insert) continue;
+                auto p = anchorMate == 0 ? paired_end::Pair{a, m, *insert, /*proper=*/true, /*rescued=*/true}
+                                         : paired_end::Pair{m, a, *insert, /*proper=*/true, /*rescued=*/true};
+                if (!best || a.errors + m.errors < best->mate1->errors + best->mate2->errors) {
+                    best = p;
+                }
+            }
+            return best;
+        };
+
+        auto bestHit = [](std::vector<paired_end::MateHit> const& hits) -> std::optional<paired_end::MateHit> {
+            if (hits.empty()) return std::nullopt;
+            return *std::ranges::min_element(hits, [](auto const& lhs, auto const& rhs) { return lhs.errors < rhs.errors; });
+        };
+
+        pairs.resize(records);
+        for (size_t r{0}; r < records; ++r) {
+            auto const& [hits1, hits2] = mateHits[r];
+            pairs[r] = paired_end::properPairs(hits1, hits2, mateLen(0, r), mateLen(1, r), insertModel, *cliMaxPairs);
+            if (pairs[r].empty() && cliReference && hits1.empty() != hits2.empty()) {
+                if (auto p = rescue(r, hits1.empty() ? 1 : 0)) {
+                    pairs[r].push_back(*p);
+                }
+            }
+            if (pairs[r].empty() && (!hits1.empty() || !hits2.empty())) {
+                pairs[r].push_back({bestHit(hits1), bestHit(hits2), 0, /*proper=*/false, /*rescued=*/false});
+            }
+            if (!pairs[r].empty()) {
+                auto const& p = pairs[r][0];
+                pairCounts[p.rescued ? 1 : p.proper ? 0 : 2] += 1;
+            }
+            mateHits[r] = {};
+        }
+        timing.push_back(profiler.stage("pair", stopWatch));
+    }
 
     auto finishTime = std::chrono::steady_clock::now();
     {
         auto ofs = fopen(cliOutput->c_str(), "w");
-        for (auto const& [queryId, seqId, pos, e] : results) {
-            fmt::print(ofs, "{} {} {}\n", queryId, seqId, pos);
+        if (cliMates) {
+            // pairId seqId1 pos1 strand1 seqId2 pos2 strand2 insert errors status, '*' for a missing mate
+            auto mate = [](std::optional<paired_end::MateHit> const& h) {
+                if (!h) return std::string{"* * *"};
+                return fmt::format("{} {} {}", h->seqId, h->pos, h->reverse?'-':'+');
+            };
+            for (size_t r{0}; r < pairs.size(); ++r) {
+                for (auto const& p : pairs[r]) {
+                    auto errors = (p.mate1 ? p.mate1->errors : 0) + (p.mate2 ? p.mate2->errors : 0);
+                    fmt::print(ofs, "{} {} {} {} {} {}\n", r, mate(p.mate1), mate(p.mate2),
+                               p.proper ? fmt::format("{}", p.insert) : std::string{"*"}, errors,
+                               p.rescued ? "rescued" : p.proper ? "proper" : "unpaired");
+                }
+            }
+        } else if (segments) {
+            // queryId seqId refStart refEnd readStart readEnd readLength score segments, '*' for reads shorter than a segment
+            for (size_t r{0}; r < chains.size(); ++r) {
+                if (segments->readLength[r] < segments->segmentLength) {
+                    fmt::print(ofs, "{} * * * * * {} * 0\n", r, segments->readLength[r]);
+                }
+                for (auto const& c : chains[r]) {
+                    fmt::print(ofs, "{} {} {} {} {} {} {} {:.1f} {}\n", r, c.seqId, c.refStart, c.refEnd,
+                               c.readStart, c.readEnd, segments->readLength[r], c.score, c.anchors);
+                }
+            }
+        } else {
+            for (auto const& [queryId, seqId, pos, e] : results) {
+                fmt::print(ofs, "{} {} {}\n", queryId, seqId, pos);
+            }
         }
         fclose(ofs);
     }
 
-    timing.emplace_back("result", stopWatch.reset());
+    timing.push_back(profiler.stage("result", stopWatch));
 
     fmt::print("stats:\n");
     double totalTime{};
     for (auto const& [key, time] : timing) {
-        fmt::print("  {:<20} {:> 10.2f}s\n", key + " time:", time);
+        auto memory = profiler.stageMemory(key);
+        fmt::print("  {:<20} {:> 10.2f}s {:>+10.1f}MB rss {:>10.1f}MB peak", key + " time:", time, memory.rssDelta / 1024. / 1024., memory.peakRss / 1024. / 1024.);
+        if (allocationTrackingEnabled()) {
+            fmt::print(" {:>10} allocations {:>10.1f}MB", memory.allocations, memory.allocatedBytes / 1024. / 1024.);
+        }
+        fmt::print("\n");
         totalTime += time;
     }
     fmt::print("  total time:          {:> 10.2f}s\n", totalTime);
     fmt::print("  queries per second:  {:> 10.0f}q/s\n", queries.size() / totalTime);
     fmt::print("  number of hits:      {:>10}\n", results.size());
+    fmt::print("  query allocations:   {:>10}\n", queryBuffer.allocations());
+    fmt::print("  hit buffer memory:   {:>10.1f}MB\n", hitBufferBytes / 1024. / 1024.);
+    fmt::print("  peak memory:         {:> 10.2f}MB\n", peakRss() / 1024. / 1024.);
+    if (!restrictRefs.empty()) {
+        fmt::print("  discarded hits:      {:>10}\n", discardedHits.load());
+        fmt::print("  skipped shards:      {:>10} of {} ({:.1f}MB not loaded)\n", skippedShards, manifest.segments.size(), skippedBytes / 1024. / 1024.);
+    }
+    if (cliMates) {
+        fmt::print("  proper pairs:        {:>10}\n", pairCounts[0]);
+        fmt::print("  rescued pairs:       {:>10}\n", pairCounts[1]);
+        fmt::print("  unpaired:            {:>10}\n", pairCounts[2]);
+    }
+    if (segments) {
+        fmt::print("  mapped reads:        {:>10} of {}\n", mappedReads, queryBuffer.size());
+        fmt::print("  bases per second:    {:> 10.0f}b/s\n", queryBuffer.totalSize() / totalTime);
+    }
+    if (adaptive) {
+        for (size_t i{0}; i < adaptiveUsage.size(); ++i) {
+            fmt::print("  {:<20} {:>10} queries {}\n", fmt::format("partition {}:", i), adaptiveUsage[i], adaptive->partitions[i]);
+        }
+    }
+    if (perfCounters) {
+        fmt::print("perf counters:\n");
+        fmt::print("  {:<16}", "stage");
+        for (auto name : PerfCounters::Names) {
+            fmt::print(" {:>14}", name);
+        }
+        fmt::print(" {:>6}\n", "IPC");
+        for (auto const& [key, values] : profiler.perfStageValues()) {
+            fmt::print("  {:<16}", key);
+            for (size_t i{0}; i < values.size(); ++i) {
+                if (perfCounters->available(i)) fmt::print(" {:>14}", values[i]);
+                else                            fmt::print(" {:>14}", "n/a");
+            }
+            if (perfCounters->available(0) && perfCounters->available(1) && values[0] > 0) {
+                fmt::print(" {:>6.2f}\n", double(values[1]) / values[0]);
+            } else {
+                fmt::print(" {:>6}\n", "n/a");
+            }
+        }
+    }
+    if constexpr (Instrumented) {
+        treeStats.print();
+    }
+
+    // latency percentiles in microseconds
+    auto latency = std::vector<std::tuple<std::string, double>>{};
+    if (measureLatency) {
+        auto histogram = LatencyHistogram{};
+        for (auto t : queryTicks) {
+            histogram.add(t);
+        }
+        auto ticksPerUs = latencySeconds > 0. ? latencyTicks / latencySeconds / 1'000'000. : 1.;
+        auto percentiles = std::array<std::tuple<char const*, double>, 4>{{{"p50", 0.5}, {"p99", 0.99}, {"p99.9", 0.999}, {"max", 1.}}};
+        for (auto const& [key, p] : percentiles) {
+            latency.emplace_back(key, histogram.percentile(p) / ticksPerUs);
+            fmt::print("  {:<20} {:> 10.1f}us\n", fmt::format("latency {}:", key), std::get<1>(latency.back()));
+        }
+
+        if (cliSlowQueries) {
+            auto order = std::vector<size_t>(queries.size());
+            std::iota(order.begin(), order.end(), 0);
+            auto n = std::min(*cliSlowQueryCount, order.size());
+            std::ranges::partial_sort(order, order.begin() + n, [&](size_t lhs, size_t rhs) {
+                return queryTicks[lhs] > queryTicks[rhs];
+            });
+            auto ofs = fopen(cliSlowQueries->c_str(), "w");
+            if (!ofs) {
+                throw error_fmt{"failed opening file {}", *cliSlowQueries};
+            }
+            fmt::print(ofs, "#query_id\tname\tstrand\tlength\tlatency_us\thits\texpanded_nodes\n");
+            auto perRecord = cliNoReverse?1:2;
+            for (size_t i{0}; i < n; ++i) {
+                auto q = order[i];
+                fmt::print(ofs, "{}\t{}\t{}\t{}\t{:.1f}\t{}\t{}\n", q, queryNames[q / perRecord], (q % perRecord)?'-':'+',
+                           queries[q].size(), queryTicks[q] / ticksPerUs, queryHits[q],
+                           Instrumented?fmt::format("{}", queryNodes[q]):std::string{"-"});
+            }
+            fclose(ofs);
+        }
+    }
+
+    if (cliStatsJson) {
+        auto values = std::vector<std::tuple<std::string, double>>{
+            {"queries", queries.size()},
+            {"queries_per_second", queries.size() / totalTime},
+            {"hits", results.size()},
+            {"query_allocations", queryBuffer.allocations()},
+            {"hit_buffer_bytes", hitBufferBytes.load()},
+            {"peak_memory_bytes", peakRss()},
+        };
+        if (!restrictRefs.empty()) {
+            values.emplace_back("discarded_hits", discardedHits.load());
+            values.emplace_back("skipped_shards", skippedShards);
+        }
+        for (auto const& [key, us] : latency) {
+            values.emplace_back(fmt::format("latency_{}_us", key), us);
+        }
+        profiler.writeStatsJson(*cliStatsJson, "search", timing, values);
+    }
+    if (cliTrace) {
+        profiler.writeChromeTrace(*cliTrace);
+    }
 }
 
 void app() {
-    // load sigma value
-    size_t sigma;
-    {
-        auto ifs     = std::ifstream{*cliIndex, std::ios::binary};
-        auto archive = cereal::BinaryInputArchive{ifs};
-        archive(sigma);
-    }
+    // load sigma value (of a single index or of a sharded index)
+    auto sigma = IndexManifest::load(*cliIndex).sigma;
     if (sigma == 5) {
-        runSearch<ivs::d_dna4>();
+        if (cliSearchStats) runSearch<ivs::d_dna4, /*Instrumented=*/true>();
+        else                runSearch<ivs::d_dna4, /*Instrumented=*/false>();
     } else if (sigma == 6) {
-        runSearch<ivs::d_dna5>();
+        if (cliSearchStats) runSearch<ivs::d_dna5, /*Instrumented=*/true>();
+        else                runSearch<ivs::d_dna5, /*Instrumented=*/false>();
     } else {
         throw error_fmt{"unknown index with {} letters", sigma};
     }
@@ -2,11 +2,20 @@
 // SPDX-FileCopyrightText: 2016-2023, Knut Reinert & MPI für molekulare Genetik
 // SPDX-License-Identifier: BSD-3-Clause
 
-#include "error_fmt.h"
+#include "QGramStats.h"
+#include "isNonRedundant.h"
 #include "tikz.h"
+#include "utils/error_fmt.h"
 
+#include <atomic>
 #include <clice/clice.h>
+#include <exception>
 #include <fmindex-collection/search/all.h>
+#include <future>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <tuple>
 
 namespace {
 void app();
@@ -81,10 +90,34 @@ auto cliTikz = clice::Argument {
 auto cliExpansionMode = clice::Argument {
     .parent = &cli,
     .args   = {"--expansion_mode"},
-    .desc   = "mode to use for generation: uniform, bottomup, topdown",
+    .desc   = "mode to use for generation: uniform, bottomup, topdown, reference (requires --qgram_stats)",
     .value  = std::string{"uniform"}
 };
+auto cliQGramStats = clice::Argument {
+    .parent = &cli,
+    .args   = {"--qgram_stats"},
+    .desc   = "q-gram statistics of a reference (written by index --qgram_stats), adds node counts weighted by the real reference",
+    .value  = std::filesystem::path{},
+};
+auto cliThreads = clice::Argument {
+    .parent = &cli,
+    .args   = {"-t", "--threads"},
+    .desc   = "number of threads used to evaluate the generators of --all and to check a single scheme",
+    .value  = size_t{std::max(1u, std::thread::hardware_concurrency())},
+};
+
+auto qgramStats() -> QGramStats const& {
+    static auto stats = []() {
+        if (!cliQGramStats) {
+            throw error_fmt{"reference model requires --qgram_stats"};
+        }
+        return QGramStats::load(*cliQGramStats);
+    }();
+    return stats;
+}
 
+// part lengths of the expansion, only the reference mode depends on the distance metric
+template <bool Edit>
 auto generateCounts(fmc::search_scheme::Scheme const& ss) -> std::vector<size_t> {
     if (ss.size() == 0) return {};
     if (*cliExpansionMode == "uniform") {
@@ -93,10 +126,183 @@ auto generateCounts(fmc::search_scheme::Scheme const& ss) -> std::vector<size_t>
         return fmc::search_scheme::optimizeByWNC(ss, *cliQueryLength, *cliAlphabetSize, *cliReferenceLength);
     } else if (*cliExpansionMode == "topdown") {
         return fmc::search_scheme::optimizeByWNC(ss, *cliQueryLength, *cliAlphabetSize, *cliReferenceLength);
+    } else if (*cliExpansionMode == "reference") {
+        return reference_model::optimizeCounts<Edit>(ss, *cliQueryLength, qgramStats());
     }
     throw std::runtime_error{"invalid parameter for expansion mode"};
 }
 
+// textual representation of a scheme, used as key for memoisation
+auto schemeKey(fmc::search_scheme::Scheme const& ss) -> std::string {
+    auto key = std::string{};
+    for (auto const& s : ss) {
+        key += fmt::format("{{{}}}{{{}}}{{{}}};", fmt::join(s.pi, ","), fmt::join(s.l, ","), fmt::join(s.u, ","));
+    }
+    return key;
+}
+
+/* Memoised results, shared between threads
+ *
+ * The first thread asking for a key computes the value, all others wait for
+ * it. Different generators often create the same scheme (and the same scheme
+ * appears for several k), so values are keyed by the scheme itself.
+ */
+template <typename T>
+struct Memo {
+    std::mutex                                   mutex;
+    std::map<std::string, std::shared_future<T>> values;
+
+    template <typename CB>
+    auto get(std::string const& key, CB&& cb) -> T {
+        auto promise = std::promise<T>{};
+        auto future  = std::shared_future<T>{};
+        bool owner   = false;
+        {
+            auto lock = std::unique_lock{mutex};
+            if (auto iter = values.find(key); iter != values.end()) {
+                future = iter->second;
+            } else {
+                future = promise.get_future().share();
+                values.emplace(key, future);
+                owner = true;
+            }
+        }
+        if (owner) {
+            try {
+                promise.set_value(cb());
+            } catch (...) {
+                promise.set_exception(std::current_exception());
+            }
+        }
+        return future.get();
+    }
+};
+
+// evaluations of search schemes needed by the --all reports, memoised
+struct SchemeEvaluator {
+    using Scheme = fmc::search_scheme::Scheme;
+
+    int64_t sigma = *cliAlphabetSize;
+    int64_t N     = *cliReferenceLength;
+    int64_t len   = *cliQueryLength;
+
+    Memo<Scheme>              schemes;
+    Memo<std::vector<size_t>> counts;
+    Memo<bool>                flags;
+    Memo<long double>         nodeCounts;
+
+    auto generate(std::string const& name, int64_t minK, int64_t maxK) -> Scheme {
+        return schemes.get(fmt::format("gen {} {} {}", name, minK, maxK), [&]() {
+            return fmc::search_scheme::generator::all.at(name).generator(minK, maxK, sigma, N);
+        });
+    }
+
+    // memoisation key of the expansion mode, the metric only matters for the reference mode
+    template <bool Edit>
+    static auto expansionKey() -> std::string {
+        if (*cliExpansionMode != "reference") return *cliExpansionMode;
+        return fmt::format("{} {}", *cliExpansionMode, Edit ? "edit" : "ham");
+    }
+
+    template <bool Edit>
+    auto expansionCounts(Scheme const& sss) -> std::vector<size_t> {
+        return counts.get(fmt::format("counts {} {}", expansionKey<Edit>(), schemeKey(sss)), [&]() {
+            return generateCounts<Edit>(sss);
+        });
+    }
+
+    template <bool Edit>
+    auto expanded(Scheme const& sss) -> Scheme {
+        return schemes.get(fmt::format("expand {} {}", expansionKey<Edit>(), schemeKey(sss)), [&]() {
+            return expand(sss, expansionCounts<Edit>(sss));
+        });
+    }
+
+    template <bool Edit>
+    auto expandedByWNC(Scheme const& sss) -> Scheme {
+        return schemes.get(fmt::format("wnc {} {}", Edit, schemeKey(sss)), [&]() {
+            return expandByWNC<Edit>(sss, len, sigma, N);
+        });
+    }
+
+    template <bool Edit>
+    auto expandedByWNCTopDown(Scheme const& sss) -> Scheme {
+        return schemes.get(fmt::format("wnc-td {} {}", Edit, schemeKey(sss)), [&]() {
+            return expandByWNCTopDown<Edit>(sss, len, sigma, N, 1);
+        });
+    }
+
+    auto complete(Scheme const& sss, int64_t minK, int64_t maxK) -> bool {
+        return flags.get(fmt::format("complete {} {} {}", minK, maxK, schemeKey(sss)), [&]() {
+            return scheme_check::isComplete(sss, minK, maxK);
+        });
+    }
+
+    auto nonRedundant(Scheme const& sss, int64_t minK, int64_t maxK) -> bool {
+        return flags.get(fmt::format("non-redundant {} {} {}", minK, maxK, schemeKey(sss)), [&]() {
+            return scheme_check::isNonRedundant(sss, minK, maxK);
+        });
+    }
+
+    template <bool Edit>
+    auto nodeCount(Scheme const& ss) -> long double {
+        return nodeCounts.get(fmt::format("nc {} {}", Edit, schemeKey(ss)), [&]() -> long double {
+            return fmc::search_scheme::nodeCount<Edit>(ss, sigma);
+        });
+    }
+
+    template <bool Edit>
+    auto expandedByReference(Scheme const& sss) -> Scheme {
+        return schemes.get(fmt::format("reference {} {}", Edit, schemeKey(sss)), [&]() {
+            return reference_model::expand<Edit>(sss, len, qgramStats());
+        });
+    }
+
+    template <bool Edit>
+    auto referenceNodeCount(Scheme const& ss) -> long double {
+        return nodeCounts.get(fmt::format("reference wnc {} {}", Edit, schemeKey(ss)), [&]() -> long double {
+            return reference_model::weightedNodeCount<Edit>(ss, qgramStats());
+        });
+    }
+
+    template <bool Edit>
+    auto weightedNodeCount(Scheme const& ss) -> long double {
+        return nodeCounts.get(fmt::format("wnc {} {}", Edit, schemeKey(ss)), [&]() -> long double {
+            return fmc::search_scheme::weightedNodeCount<Edit>(ss, sigma, N);
+        });
+    }
+};
+
+// calls cb(i) for every i in [0, n) on cliThreads threads
+template <typename CB>
+void parallelFor(size_t n, CB&& cb) {
+    auto next  = std::atomic<size_t>{};
+    auto error = std::exception_ptr{};
+    auto mutex = std::mutex{};
+    auto worker = [&]() {
+        try {
+            for (auto i = next++; i < n; i = next++) {
+                cb(i);
+            }
+        } catch (...) {
+            auto lock = std::unique_lock{mutex};
+            if (!error) error = std::current_exception();
+            next = n;
+        }
+    };
+    auto threads = std::vector<std::thread>{};
+    for (size_t i{1}; i < std::min(*cliThreads, n); ++i) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& t : threads) {
+        t.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
 
 void printSingleScheme() {
     // pick the correct generator
@@ -131,8 +337,8 @@ void printSingleScheme() {
     fmt::print("number of parts:            {}\n", parts);
     fmt::print("number of searches:         {}\n", ss.size());
     fmt::print("valid:                      {}\n", isValid(sss));
-    fmt::print("complete:                   {}\n", isComplete(sss, *cliMinAllowedErrors, *cliMaxAllowedErrors));
-    fmt::print("non-redundant:              {}\n", isNonRedundant(sss,*cliMinAllowedErrors, *cliMaxAllowedErrors));
+    fmt::print("complete:                   {}\n", scheme_check::isComplete(sss, *cliMinAllowedErrors, *cliMaxAllowedErrors, *cliThreads));
+    fmt::print("non-redundant:              {}\n", scheme_check::isNonRedundant(sss, *cliMinAllowedErrors, *cliMaxAllowedErrors, *cliThreads));
     fmt::print("node count (ham):           {}\n", nodeCount</*Edit=*/false>(ss, *cliAlphabetSize));
     fmt::print("weighted node count (ham):  {}\n", weightedNodeCount</*Edit=*/false>(ss, *cliAlphabetSize, *cliReferenceLength));
     fmt::print("dynamic wnc (ham):          {}\n", weightedNodeCount</*Edit=*/false>(dss, *cliAlphabetSize, *cliReferenceLength));
@@ -141,6 +347,13 @@ void printSingleScheme() {
     fmt::print("weighted node count (edit): {}\n", weightedNodeCount</*Edit=*/true>(ss, *cliAlphabetSize, *cliReferenceLength));
     fmt::print("dynamic wnc (edit):         {}\n", weightedNodeCount</*Edit=*/true>(dss, *cliAlphabetSize, *cliReferenceLength));
     fmt::print("dynamic wnc td (edit):      {}\n", weightedNodeCount</*Edit=*/true>(dss_td, *cliAlphabetSize, *cliReferenceLength));
+    if (cliQGramStats) {
+        auto const& stats = qgramStats();
+        fmt::print("reference wnc (ham):        {}\n", reference_model::weightedNodeCount</*Edit=*/false>(ss, stats));
+        fmt::print("reference dyn wnc (ham):    {}\n", reference_model::weightedNodeCount</*Edit=*/false>(reference_model::expand</*Edit=*/false>(sss, *cliQueryLength, stats), stats));
+        fmt::print("reference wnc (edit):       {}\n", reference_model::weightedNodeCount</*Edit=*/true>(ss, stats));
+        fmt::print("reference dyn wnc (edit):   {}\n", reference_model::weightedNodeCount</*Edit=*/true>(reference_model::expand</*Edit=*/true>(sss, *cliQueryLength, stats), stats));
+    }
 
 
     fmt::print("searches:  {:^{}}  {:^{}}  {:^{}}\n", "pi", parts*3, "L", parts*3, "U", parts*3);
@@ -172,7 +385,8 @@ void printTikz(std::string const& path_prefix) {
     // generate search schemes
     auto sss = e.generator(*cliMinAllowedErrors, *cliMaxAllowedErrors, *cliAlphabetSize, *cliReferenceLength);
 
-    auto counts = generateCounts(sss);
+    // the diagram shows the expansion for the edit distance
+    auto counts = generateCounts</*Edit=*/true>(sss);
     for (size_t i{0}; i < sss.size(); ++i) {
         auto filename = fmt::format("{}-{:02}.tikz", path_prefix, i);
         auto ofs = std::ofstream(filename);
@@ -188,7 +402,11 @@ void printTable() {
     fmt::print("max errors:          {}\n", *cliMaxAllowedErrors);
     fmt::print("reference length:    {}\n", *cliReferenceLength);
 
-    fmt::print("{:^15} | {:^6} {:^8} {:^6} {:^8} {:^10} | {:^32} | {:^25} | {:^25} | {:^25}\n", "name", "parts", "searches", "valid", "complete", "non-red", "node count ham/edit", "weighted nnc ham/edit", "dyn exp bu", "dyn exp td");
+    fmt::print("{:^15} | {:^6} {:^8} {:^6} {:^8} {:^10} | {:^32} | {:^25} | {:^25} | {:^25}", "name", "parts", "searches", "valid", "complete", "non-red", "node count ham/edit", "weighted nnc ham/edit", "dyn exp bu", "dyn exp td");
+    if (cliQGramStats) {
+        fmt::print(" | {:^25} | {:^25}", "reference wnc", "reference dyn exp");
+    }
+    fmt::print("\n");
     auto order = std::vector<std::string>{"backtracking", "optimum", "01*0", "01*0_opt", "pigeon", "pigeon_opt", "suffix", "h2-k1", "h2-k2", "h2-k3", "kianfar", "kucherov-k1", "kucherov-k2", "lam", "hato", "pex-td", "pex-td-l", "pex-bu", "pex-bu-l"};
     for (auto const& [key, e] : fmc::search_scheme::generator::all) {
         if (std::find(order.begin(), order.end(), key) == order.end()) {
@@ -196,36 +414,39 @@ void printTable() {
             fmt::print("WARNING: missing {} in order list\n", key);
         }
     }
+    auto known = std::vector<std::string>{};
     for (auto const& o : order) {
         if (auto iter = fmc::search_scheme::generator::all.find(o); iter == fmc::search_scheme::generator::all.end()) {
             fmt::print("Warning: generator {} doesn't exists\n", o);
             continue;
         }
+        known.push_back(o);
+    }
 
-        auto sigma = *cliAlphabetSize;
-        auto N     = *cliReferenceLength;
+    // rows are computed in parallel and printed in order
+    auto eval = SchemeEvaluator{};
+    auto rows = std::vector<std::string>(known.size());
+    parallelFor(known.size(), [&](size_t i) {
+        auto minK = *cliMinAllowedErrors;
+        auto maxK = *cliMaxAllowedErrors;
 
-        auto const& e = fmc::search_scheme::generator::all[o];
+        auto const& e = fmc::search_scheme::generator::all.at(known[i]);
         // generate search schemes
-        auto sss = e.generator(*cliMinAllowedErrors, *cliMaxAllowedErrors, sigma, N);
+        auto sss = eval.generate(known[i], minK, maxK);
 
         // expand search schemes, so they match the length of the query
-        auto counts = generateCounts(sss);
-        auto ss = expand(sss, counts);
-
-        // expand by node count
-//        auto dss_ham  = expandByNC</*Edit=*/false>(sss, *cliQueryLength, sigma);
-//        auto dss_edit = expandByNC</*Edit=*/true> (sss, *cliQueryLength, sigma);
+        auto ss_ham  = eval.expanded</*Edit=*/false>(sss);
+        auto ss_edit = eval.expanded</*Edit=*/true>(sss);
 
         // expand by weighted node count
-        auto dess_ham  = expandByWNC</*Edit=*/false>(sss, *cliQueryLength, sigma, N);
-        auto dess_edit = expandByWNC</*Edit=*/true> (sss, *cliQueryLength, sigma, N);
+        auto dess_ham  = eval.expandedByWNC</*Edit=*/false>(sss);
+        auto dess_edit = eval.expandedByWNC</*Edit=*/true> (sss);
 
         // expand by weighted node count top down
-        auto dess_ham_td  = expandByWNCTopDown</*Edit=*/false>(sss, *cliQueryLength, sigma, N, 1);
-        auto dess_edit_td = expandByWNCTopDown</*Edit=*/true> (sss, *cliQueryLength, sigma, N, 1);
+        auto dess_ham_td  = eval.expandedByWNCTopDown</*Edit=*/false>(sss);
+        auto dess_edit_td = eval.expandedByWNCTopDown</*Edit=*/true> (sss);
 
-        auto parts = ss.size()>0?sss[0].pi.size():0;
+        auto parts = ss_edit.size()>0?sss[0].pi.size():0;
 
         struct {
             long double countHam;
@@ -233,25 +454,43 @@ void printTable() {
         } stat_ss, stat_ss_w, stat_dess, stat_dess_td;
 
         auto valid         = isValid(sss);
-        auto complete      = isComplete(sss, *cliMinAllowedErrors, *cliMaxAllowedErrors);
-        auto non_redundant = isNonRedundant(sss, *cliMinAllowedErrors, *cliMaxAllowedErrors);
-
-        stat_ss      = { .countHam  = nodeCount</*Edit=*/false>(ss, sigma),
-                         .countEdit = nodeCount</*Edit=*/true>(ss, sigma)};
-        stat_ss_w    = { .countHam  = weightedNodeCount</*Edit=*/false>(ss, sigma, N),
-                         .countEdit = weightedNodeCount</*Edit=*/true>(ss, sigma, N)};
-        stat_dess    = { .countHam  = weightedNodeCount</*Edit=*/false>(dess_ham, sigma, N),
-                      .countEdit = weightedNodeCount</*Edit=*/true>(dess_edit, sigma, N)};
-        stat_dess_td = { .countHam  = weightedNodeCount</*Edit=*/false>(dess_ham_td, sigma, N),
-                         .countEdit = weightedNodeCount</*Edit=*/true>(dess_edit_td, sigma, N)};
-
-        fmt::print("{:>15} | {:>6} {:>8} {:^6} {:^8} {:^10} | {:>15.0f} {:>15.0f}  | {:>12.2f} {:>12.2f} | {:>12.2f} {:>12.2f} | {:>12.2f} {:>12.2f}\n", e.name, parts, sss.size(), valid, complete, non_redundant, stat_ss.countHam, stat_ss.countEdit, stat_ss_w.countHam, stat_ss_w.countEdit, stat_dess.countHam, stat_dess.countEdit, stat_dess_td.countHam, stat_dess_td.countEdit);
+        auto complete      = eval.complete(sss, minK, maxK);
+        auto non_redundant = eval.nonRedundant(sss, minK, maxK);
+
+        stat_ss      = { .countHam  = eval.nodeCount</*Edit=*/false>(ss_ham),
+                         .countEdit = eval.nodeCount</*Edit=*/true>(ss_edit)};
+        stat_ss_w    = { .countHam  = eval.weightedNodeCount</*Edit=*/false>(ss_ham),
+                         .countEdit = eval.weightedNodeCount</*Edit=*/true>(ss_edit)};
+        stat_dess    = { .countHam  = eval.weightedNodeCount</*Edit=*/false>(dess_ham),
+                         .countEdit = eval.weightedNodeCount</*Edit=*/true>(dess_edit)};
+        stat_dess_td = { .countHam  = eval.weightedNodeCount</*Edit=*/false>(dess_ham_td),
+                         .countEdit = eval.weightedNodeCount</*Edit=*/true>(dess_edit_td)};
+
+        rows[i] = fmt::format("{:>15} | {:>6} {:>8} {:^6} {:^8} {:^10} | {:>15.0f} {:>15.0f}  | {:>12.2f} {:>12.2f} | {:>12.2f} {:>12.2f} | {:>12.2f} {:>12.2f}", e.name, parts, sss.size(), valid, complete, non_redundant, stat_ss.countHam, stat_ss.countEdit, stat_ss_w.countHam, stat_ss_w.countEdit, stat_dess.countHam, stat_dess.countEdit, stat_dess_td.countHam, stat_dess_td.countEdit);
+        if (cliQGramStats) {
+            // node counts weighted by the q-gram statistics of the real reference
+            rows[i] += fmt::format(" | {:>12.2f} {:>12.2f} | {:>12.2f} {:>12.2f}",
+                                   eval.referenceNodeCount</*Edit=*/false>(ss_ham), eval.referenceNodeCount</*Edit=*/true>(ss_edit),
+                                   eval.referenceNodeCount</*Edit=*/false>(eval.expandedByReference</*Edit=*/false>(sss)),
+                                   eval.referenceNodeCount</*Edit=*/true>(eval.expandedByReference</*Edit=*/true>(sss)));
+        }
+        rows[i] += "\n";
+    });
+    for (auto const& row : rows) {
+        fmt::print("{}", row);
     }
 }
 
 void printColumba() {
     std::filesystem::create_directories(*cliColumba);
+    auto keys = std::vector<std::string>{};
     for (auto const& [key, e] : fmc::search_scheme::generator::all) {
+        keys.push_back(key);
+    }
+    // every generator writes into its own directory
+    auto eval = SchemeEvaluator{};
+    parallelFor(keys.size(), [&](size_t i) {
+        auto const& key = keys[i];
         std::filesystem::create_directories(*cliColumba / key);
 
         // print name
@@ -261,7 +500,7 @@ void printColumba() {
         }
         for (auto k{*cliMinAllowedErrors}; k <= *cliMaxAllowedErrors; ++k) {
             // generate search schemes
-            auto sss = e.generator(*cliMinAllowedErrors, k, *cliAlphabetSize, *cliReferenceLength);
+            auto sss = eval.generate(key, *cliMinAllowedErrors, k);
 
             if (sss.empty()) continue; // no search scheme exists
 
@@ -272,7 +511,7 @@ void printColumba() {
                 fmt::print(ofs, "{{{}}} {{{}}} {{{}}}\n", fmt::join(s.pi, ","), fmt::join(s.l, ","), fmt::join(s.u, ","));
             }
         }
-    }
+    });
 }
 
 void printYaml() {
@@ -282,37 +521,53 @@ void printYaml() {
     fmt::print("max errors:          {}\n", *cliMaxAllowedErrors);
     fmt::print("reference length:    {}\n", *cliReferenceLength);
     fmt::print("---\n");
+
+    // all (k, generator) pairs are evaluated in parallel, entries are printed in order
+    auto jobs = std::vector<std::tuple<int64_t, std::string>>{};
     for (auto k{*cliMinAllowedErrors}; k <= *cliMaxAllowedErrors; ++k) {
         for (auto const& [key, e] : fmc::search_scheme::generator::all) {
-            // generate search schemes
-            auto sss = e.generator(*cliMinAllowedErrors, k, *cliAlphabetSize, *cliReferenceLength);
-
-            // expand search schemes, so they match the length of the query
-            auto counts = generateCounts(sss);
-            auto ss = expand(sss, counts);
-
-            auto name          = e.name;
-            auto parts         = ss.size()>0?sss[0].pi.size():0;
-            auto searches      = ss.size();
-            auto valid         = isValid(sss);
-            auto complete      = isComplete(sss, *cliMinAllowedErrors, k);
-            auto nodeCount     = fmc::search_scheme::nodeCount</*Edit=*/false>(ss, *cliAlphabetSize);
-            auto weightedCount = weightedNodeCount</*Edit=*/false>(ss, *cliAlphabetSize, *cliReferenceLength);
-            fmt::print("- name: \"{}\"\n", name);
-            fmt::print("  parts: {}\n", parts);
-            fmt::print("  counts: [{}]\n", fmt::join(counts, ", "));
-            fmt::print("  searchCt: {}\n", searches);
-            fmt::print("  valid: {}\n", valid);
-            fmt::print("  complete: {}\n", complete);
-            fmt::print("  nodeCount: {}\n", nodeCount);
-            fmt::print("  weightedNodeCount: {:.2f}\n", weightedCount);
-            fmt::print("  searches:\n");
-            for (auto const& s : sss) {
-                fmt::print("  - pi: [{}]\n", fmt::join(s.pi, ", "));
-                fmt::print("    l: [{}]\n", fmt::join(s.l, ", "));
-                fmt::print("    u: [{}]\n", fmt::join(s.u, ", "));
-            }
+            jobs.emplace_back(k, key);
+        }
+    }
+    auto eval    = SchemeEvaluator{};
+    auto entries = std::vector<std::string>(jobs.size());
+    parallelFor(jobs.size(), [&](size_t i) {
+        auto const& [k, key] = jobs[i];
+        auto const& e = fmc::search_scheme::generator::all.at(key);
+
+        // generate search schemes
+        auto sss = eval.generate(key, *cliMinAllowedErrors, k);
+
+        // expand search schemes, so they match the length of the query
+        // the reported node counts are hamming counts
+        auto counts = eval.expansionCounts</*Edit=*/false>(sss);
+        auto ss     = eval.expanded</*Edit=*/false>(sss);
+
+        auto name          = e.name;
+        auto parts         = ss.size()>0?sss[0].pi.size():0;
+        auto searches      = ss.size();
+        auto valid         = isValid(sss);
+        auto complete      = eval.complete(sss, *cliMinAllowedErrors, k);
+        auto nodeCount     = eval.nodeCount</*Edit=*/false>(ss);
+        auto weightedCount = eval.weightedNodeCount</*Edit=*/false>(ss);
+        auto& out = entries[i];
+        out += fmt::format("- name: \"{}\"\n", name);
+        out += fmt::format("  parts: {}\n", parts);
+        out += fmt::format("  counts: [{}]\n", fmt::join(counts, ", "));
+        out += fmt::format("  searchCt: {}\n", searches);
+        out += fmt::format("  valid: {}\n", valid);
+        out += fmt::format("  complete: {}\n", complete);
+        out += fmt::format("  nodeCount: {:.0f}\n", nodeCount);
+        out += fmt::format("  weightedNodeCount: {:.2f}\n", weightedCount);
+        out += fmt::format("  searches:\n");
+        for (auto const& s : sss) {
+            out += fmt::format("  - pi: [{}]\n", fmt::join(s.pi, ", "));
+            out += fmt::format("    l: [{}]\n", fmt::join(s.l, ", "));
+            out += fmt::format("    u: [{}]\n", fmt::join(s.u, ", "));
         }
+    });
+    for (auto const& entry : entries) {
+        fmt::print("{}", entry);
     }
 }
 
@@ -0,0 +1,302 @@
+// SPDX-FileCopyrightText: 2006-2024, Knut Reinert & Freie Universität Berlin
+// SPDX-FileCopyrightText: 2016-2024, Knut Reinert & MPI für molekulare Genetik
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include "IndexManifest.h"
+#include "ReadSimulator.h"
+#include "SearchTreeStats.h"
+#include "SequenceBuffer.h"
+#include "SequenceReader.h"
+#include "TuningProfile.h"
+#include "utils/StopWatch.h"
+#include "utils/error_fmt.h"
+
+#include <algorithm>
+#include <array>
+#include <cereal/archives/binary.hpp>
+#include <clice/clice.h>
+#include <fmindex-collection/fmindex-collection.h>
+#include <fstream>
+#include <ivsigma/ivsigma.h>
+#include <limits>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+void app();
+auto cli = clice::Argument {
+    .args   = "tune",
+    .desc   = "measures every search scheme generator on an index and stores the fastest in a tuning profile, used by search",
+    .cb     = app,
+};
+
+auto cliIndex = clice::Argument {
+    .parent = &cli,
+    .args   = {"-i", "--index"},
+    .desc   = "path to the index file",
+    .value  = std::filesystem::path{},
+};
+
+auto cliQuery = clice::Argument {
+    .parent = &cli,
+    .args   = {"-q", "--query"},
+    .desc   = "path to a query file, reads are sampled from it (fasta or fastq)",
+    .value  = std::filesystem::path{},
+};
+
+auto cliReference = clice::Argument {
+    .parent = &cli,
+    .args   = {"-r", "--reference"},
+    .desc   = "path to the indexed reference, reads are simulated from it if no query file is given",
+    .value  = std::filesystem::path{},
+};
+
+auto cliOutput = clice::Argument {
+    .parent = &cli,
+    .args   = {"-o", "--output"},
+    .desc   = "path of the tuning profile (default: <index>.tune.json, which is picked up by search)",
+    .value  = std::filesystem::path{},
+};
+
+auto cliNumErrors = clice::Argument {
+    .parent = &cli,
+    .args   = {"-e", "--errors"},
+    .desc   = "tune for 1 up to this number of errors",
+    .value  = size_t{2},
+};
+
+enum class DistanceMetric { Hamming, Levenshtein, Both };
+auto cliDistanceMetric = clice::Argument {
+    .parent  = &cli,
+    .args    = {"-d", "--distance-metric"},
+    .desc    = "which distance metric to tune. ham: hamming, lev: levenshtein(edit) distance or both",
+    .value   = DistanceMetric::Both,
+    .mapping = {{{"ham", DistanceMetric::Hamming}, {"lev", DistanceMetric::Levenshtein}, {"both", DistanceMetric::Both}}}
+};
+
+auto cliSample = clice::Argument {
+    .parent = &cli,
+    .args   = {"-n", "--sample"},
+    .desc   = "number of reads used for measuring",
+    .value  = size_t{1000},
+};
+
+auto cliReadLength = clice::Argument {
+    .parent = &cli,
+    .args   = {"-l", "--read_length"},
+    .desc   = "length of simulated reads",
+    .value  = size_t{150},
+};
+
+auto cliSeed = clice::Argument {
+    .parent = &cli,
+    .args   = "--seed",
+    .desc   = "seed for sampling and simulating reads",
+    .value  = uint64_t{0},
+};
+
+auto cliRepeats = clice::Argument {
+    .parent = &cli,
+    .args   = "--repeats",
+    .desc   = "number of runs of every configuration, the fastest run is reported",
+    .value  = size_t{3},
+};
+
+auto cliGenerators = clice::Argument {
+    .parent = &cli,
+    .args   = {"-g", "--generators"},
+    .desc   = "only measure these generators (default: all)",
+    .value  = std::vector<std::string>{},
+};
+
+// reservoir sample of the reads of a fasta/fastq file
+auto sampleReads(std::filesystem::path const& path, size_t n, std::mt19937_64& generator) -> std::vector<std::string> {
+    auto reads = std::vector<std::string>{};
+    size_t seen{};
+    forEachSequenceRecord(path, [&](auto const& record) {
+        seen += 1;
+        if (reads.size() < n) {
+            reads.emplace_back(record.seq);
+            return;
+        }
+        auto pos = std::uniform_int_distribution<size_t>{0, seen-1}(generator);
+        if (pos < n) {
+            reads[pos] = record.seq;
+        }
+    });
+    return reads;
+}
+
+// reads with 0 up to `errors` random errors, only substitutions for hamming distance
+auto simulateReads(std::vector<std::string> const& sequences, size_t n, size_t errors, bool edit, std::mt19937_64& generator) -> std::vector<std::string> {
+    auto readGenerator = ReadGenerator { .sequences  = sequences,
+                                         .readLength = *cliReadLength,
+                                         .generator  = std::mt19937_64{generator()} };
+    auto pickCount = std::uniform_int_distribution<size_t>{0, errors};
+    auto pickError = std::uniform_int_distribution<size_t>{0, edit?2:0};
+    auto reads = std::vector<std::string>{};
+    for (size_t i{0}; i < n; ++i) {
+        auto error = std::array<size_t, 3>{};
+        for (size_t j{0}, count = pickCount(generator); j < count; ++j) {
+            error[pickError(generator)] += 1;
+        }
+        auto transcript = Transcript{generator, *cliReadLength, error[0], error[1], error[2]};
+        auto [seqId, pos, read] = readGenerator.generate(transcript.lengthOfRef());
+        reads.emplace_back(readGenerator.applyTranscript(read, transcript.transcript));
+    }
+    return reads;
+}
+
+template <typename Alphabet>
+void runTune() {
+    constexpr size_t Sigma = Alphabet::size();
+    // the counting string is used for all configurations, so its overhead does not change the ranking
+    using Index = fmc::BiFMIndex<Sigma, CountingString>;
+
+    auto stopWatch = StopWatch();
+
+    // a sharded index is tuned on its first shard
+    auto manifest = IndexManifest::load(*cliIndex);
+    auto index = Index{};
+    {
+        auto ifs     = std::ifstream{IndexManifest::segmentPath(*cliIndex, manifest.segments[0]), std::ios::binary};
+        auto archive = cereal::BinaryInputArchive{ifs};
+        size_t sigma;
+        archive(sigma);
+        archive(index);
+    }
+    auto indexSize = index.size();
+    fmt::print("index loaded ({} shards, tuning on shard 0): {:.2f}s\n", manifest.segments.size(), stopWatch.reset());
+
+    auto generator = std::mt19937_64{*cliSeed};
+    auto reference = std::vector<std::string>{};
+    auto sampled   = std::vector<std::string>{};
+    if (cliQuery) {
+        sampled = sampleReads(*cliQuery, *cliSample, generator);
+        if (sampled.empty()) {
+            throw error_fmt{"query file {} was empty - abort", *cliQuery};
+        }
+    } else if (cliReference) {
+        for (auto record : SequenceReader{*cliReference}) {
+            auto seq = std::string{record.seq};
+            for (auto& c : seq) {
+                c = ivs::dna4::normalize_char(c);
+                if (!ivs::verify_char(c)) c = 'A';
+            }
+            reference.emplace_back(std::move(seq));
+        }
+    } else {
+        throw error_fmt{"either a query file (-q) or the indexed reference (-r) is required"};
+    }
+
+    auto generators = std::vector<std::string>{};
+    for (auto const& [name, gen] : fmc::search_scheme::generator::all) {
+        if (cliGenerators->empty() || std::ranges::find(*cliGenerators, name) != cliGenerators->end()) {
+            generators.push_back(name);
+        }
+    }
+
+    auto metrics = std::vector<bool>{}; // edit distance?
+    if (*cliDistanceMetric != DistanceMetric::Levenshtein) metrics.push_back(false);
+    if (*cliDistanceMetric != DistanceMetric::Hamming)     metrics.push_back(true);
+
+    auto profilePath = cliOutput ? *cliOutput : TuningProfile::path(*cliIndex);
+    auto profile     = TuningProfile::load(profilePath);
+
+    for (auto edit : metrics) {
+        for (size_t k{1}; k <= *cliNumErrors; ++k) {
+            // forward reads and their reverse complements, as searched by `sahara search`
+            auto reads = cliQuery ? sampled : simulateReads(reference, *cliSample, k, edit, generator);
+            auto queryBuffer = SequenceBuffer{};
+            for (auto const& read : reads) {
+                auto query = queryBuffer.append(read.size());
+                ivs::convert_char_to_rank<Alphabet>(read, query);
+                if (auto pos = ivs::verify_rank(query); pos) {
+                    throw error_fmt{"read has invalid character at position {} '{}'({:x})", *pos, read[*pos], read[*pos]};
+                }
+                appendReverseComplement<Alphabet>(queryBuffer);
+            }
+            auto queries = queryBuffer.sequences();
+            auto len     = queries[0].size();
+            auto metric  = std::string{edit?"lev":"ham"};
+
+            fmt::print("{} errors, {} distance, {} queries of length {}:\n", k, metric, queries.size(), len);
+            fmt::print("  {:<20} {:<9} {:>14} {:>16} {:>16} {:>10}\n", "generator", "expansion", "time/query", "expanded nodes", "predicted nodes", "hits");
+
+            auto best = std::optional<TuningProfile::Entry>{};
+            for (auto const& name : generators) {
+                for (auto dynamic : {false, true}) {
+                    auto scheme = decltype(fmc::search_scheme::expand(fmc::search_scheme::generator::all.at(name).generator(0, k, 0, 0), len)){};
+                    try {
+                        auto oss = fmc::search_scheme::generator::all.at(name).generator(0, k, /*unused*/0, /*unused*/0);
+                        if (!dynamic)  scheme = fmc::search_scheme::expand(oss, len);
+                        else if (edit) scheme = fmc::search_scheme::expandByWNCTopDown</*Edit=*/true>(oss, len, Sigma, indexSize, 1);
+                        else           scheme = fmc::search_scheme::expandByWNCTopDown</*Edit=*/false>(oss, len, Sigma, indexSize, 1);
+                        if (!edit) scheme = limitToHamming(scheme);
+                    } catch (std::exception const& e) {
+                        fmt::print("  {:<20} {:<9} skipped: {}\n", name, dynamic?"dynamic":"static", e.what());
+                        continue;
+                    }
+                    if (scheme.empty()) continue;
+                    auto predicted = edit ? fmc::search_scheme::weightedNodeCount</*Edit=*/true>(scheme, Sigma, indexSize)
+                                          : fmc::search_scheme::weightedNodeCount</*Edit=*/false>(scheme, Sigma, indexSize);
+
+                    auto seconds = std::numeric_limits<double>::max();
+                    auto nodes   = size_t{};
+                    auto hits    = size_t{};
+                    for (size_t r{0}; r < std::max(size_t{1}, *cliRepeats); ++r) {
+                        hits = 0;
+                        auto nodesBefore = search_tree_stats::allRankCalls;
+                        auto res_cb = [&](size_t, auto const& cursor, size_t) {
+                            hits += cursor.len;
+                        };
+                        auto runWatch = StopWatch();
+                        if (edit) fmc::search_ng24::search</*Edit=*/true> (index, queries, scheme, res_cb);
+                        else      fmc::search_ng24::search</*Edit=*/false>(index, queries, scheme, res_cb);
+                        seconds = std::min(seconds, runWatch.peek());
+                        nodes   = (search_tree_stats::allRankCalls - nodesBefore) / 2;
+                    }
+                    auto entry = TuningProfile::Entry {
+                        .errors    = k,
+                        .length    = len,
+                        .metric    = metric,
+                        .generator = name,
+                        .dynamic   = dynamic,
+                        .seconds   = seconds / queries.size(),
+                        .nodes     = double(nodes) / queries.size(),
+                    };
+                    fmt::print("  {:<20} {:<9} {:>12.2f}us {:>16.1f} {:>16.1f} {:>10}\n", name, dynamic?"dynamic":"static",
+                               entry.seconds * 1'000'000., entry.nodes, double(predicted), hits);
+                    if (!best || entry.seconds < best->seconds) {
+                        best = entry;
+                    }
+                }
+            }
+            if (!best) {
+                fmt::print("  no generator supports {} errors\n", k);
+                continue;
+            }
+            fmt::print("  fastest: {} ({} expansion)\n", best->generator, best->dynamic?"dynamic":"static");
+            profile.set(*best);
+        }
+    }
+    profile.save(profilePath);
+    fmt::print("tuning profile written to {} ({:.2f}s)\n", profilePath, stopWatch.peek());
+}
+
+void app() {
+    if (!std::filesystem::exists(*cliIndex)) {
+        throw error_fmt{"no valid index path at {}", *cliIndex};
+    }
+    auto sigma = IndexManifest::load(*cliIndex).sigma;
+    if (sigma == 5) {
+        runTune<ivs::d_dna4>();
+    } else if (sigma == 6) {
+        runTune<ivs::d_dna5>();
+    } else {
+        throw error_fmt{"unknown index with {} letters", sigma};
+    }
+}
+}
@@ -2,6 +2,8 @@
 // SPDX-FileCopyrightText: 2016-2024, Knut Reinert & MPI für molekulare Genetik
 // SPDX-License-Identifier: BSD-3-Clause
 
+#include "SequenceBuffer.h"
+#include "SequenceReader.h"
 #include "utils/StopWatch.h"
 #include "utils/error_fmt.h"
 
@@ -31,7 +33,7 @@ auto cli = clice::Argument {
 auto cliQuery = clice::Argument {
     .parent = &cli,
     .args   = {"-q", "--query"},
-    .desc   = "path to a query file",
+    .desc   = "path to a query file (fasta or fastq, may be gzip/bgzf compressed)",
     .value  = std::filesystem::path{},
 };
 
@@ -63,19 +65,20 @@ void app() {
 
     auto stopWatch = StopWatch();
 
-    // load fasta file
+    // load fasta or fastq file
     size_t totalSize{};
-    auto queries = std::vector<std::vector<uint8_t>>{};
-    for (auto record : ivio::fasta::reader {{*cliQuery}}) {
+    auto queries = SequenceBuffer{};
+    forEachSequenceRecord(*cliQuery, [&](auto const& record) {
         totalSize += record.seq.size();
-        queries.emplace_back(ivs::convert_char_to_rank<Alphabet>(record.seq));
-        if (auto pos = ivs::verify_rank(queries.back()); pos) {
+        auto query = queries.append(record.seq.size());
+        ivs::convert_char_to_rank<Alphabet>(record.seq, query);
+        if (auto pos = ivs::verify_rank(query); pos) {
             throw error_fmt{"query '{}' ({}) has invalid character at position {} '{}'({:x})", record.id, queries.size(), *pos, record.seq[*pos], record.seq[*pos]};
         }
         if (!cliNoReverse) {
-            queries.emplace_back(ivs::reverse_complement_rank<Alphabet>(queries.back()));
+            appendReverseComplement<Alphabet>(queries);
         }
-    }
+    });
     if (queries.empty()) {
         throw error_fmt{"query file {} was empty - abort\n", *cliQuery};
     }
@@ -150,5 +153,6 @@ void app() {
     fmt::print("  total time:          {:> 10.2f}s\n", totalTime);
     fmt::print("  queries per second:  {:> 10.0f}q/s\n", queries.size() / totalTime);
     fmt::print("  number of hits:      {:>10}\n", results.size());
+    fmt::print("  query allocations:   {:>10}\n", queries.allocations());
 }
 }
@@ -0,0 +1,37 @@
+// SPDX-FileCopyrightText: 2006-2024, Knut Reinert & Freie Universität Berlin
+// SPDX-FileCopyrightText: 2016-2024, Knut Reinert & MPI für molekulare Genetik
+// SPDX-License-Identifier: BSD-3-Clause
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+/* Counts of all allocations through operator new
+ *
+ * The counting operator new is defined in AllocationHook.cpp. Counting is
+ * disabled by default, so untracked runs only pay for a relaxed load.
+ */
+namespace allocation_stats {
+extern std::atomic<bool>     enabled;
+extern std::atomic<uint64_t> count;
+extern std::atomic<uint64_t> bytes;
+}
+
+struct AllocationStats {
+    uint64_t allocations{};
+    uint64_t bytes{};
+};
+
+inline void enableAllocationTracking() {
+    allocation_stats::enabled.store(true, std::memory_order_relaxed);
+}
+
+inline auto allocationTrackingEnabled() -> bool {
+    return allocation_stats::enabled.load(std::memory_order_relaxed);
+}
+
+// number of allocations and allocated bytes since tracking was enabled
+inline auto allocationStats() -> AllocationStats {
+    return {allocation_stats::count.load(std::memory_order_relaxed), allocation_stats::bytes.load(std::memory_order_relaxed)};
+}
@@ -0,0 +1,236 @@
+// SPDX-FileCopyrightText: 2006-2024, Knut Reinert & Freie Universität Berlin
+// SPDX-FileCopyrightText: 2016-2024, Knut Reinert & MPI für molekulare Genetik
+// SPDX-License-Identifier: BSD-3-Clause
+
+#pragma once
+
+#include "error_fmt.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <istream>
+#include <memory>
+#include <streambuf>
+#include <thread>
+#include <vector>
+#include <zlib.h>
+
+enum class Compression { None, Gzip, Bgzf };
+
+// detects the compression of a file by its magic bytes
+inline auto detectCompression(std::filesystem::path const& path) -> Compression {
+    auto ifs = std::ifstream{path, std::ios::binary};
+    auto header = std::array<uint8_t, 16>{};
+    ifs.read(reinterpret_cast<char*>(header.data()), header.size());
+    auto len = size_t(ifs.gcount());
+    if (len < 2 || header[0] != 0x1f || header[1] != 0x8b) {
+        return Compression::None;
+    }
+    // bgzf: gzip with extra field (FLG.FEXTRA) containing the subfield 'BC'
+    if (len >= 16 && (header[3] & 0x04) && header[12] == 'B' && header[13] == 'C') {
+        return Compression::Bgzf;
+    }
+    return Compression::Gzip;
+}
+
+/* A stream buffer that decompresses gzip or bgzf files while they are read.
+ *
+ * Decompression errors are thrown from underflow(), DecompressStream enables
+ * exceptions for badbit, such that they reach the reader instead of ending
+ * the input silently.
+ *
+ * Gzip is inherently sequential, the next chunk is inflated on a second
+ * thread while the current one is consumed. Bgzf consists of independent
+ * blocks, batches of blocks are inflated on up to `threadNbr` threads ahead
+ * of the consumer and delivered in file order.
+ */
+struct DecompressStreamBuf : std::streambuf {
+private:
+    static constexpr size_t ChunkSize = 1 << 22; // decompressed chunk size for gzip, batch size of compressed bytes for bgzf
+
+    std::ifstream ifs;
+    Compression   compression;
+    size_t        threadNbr;
+
+    std::vector<char> current;                      // buffer that is currently being read
+    std::deque<std::future<std::vector<char>>> pending; // chunks being decompressed, in file order
+
+    // gzip state, only used by a single thread at a time
+    z_stream          zs{};
+    std::vector<char> zsInput = std::vector<char>(ChunkSize);
+    bool              zsEnd{false};
+    bool              zsInMember{false}; // inside a gzip member, its end was not seen yet
+
+    auto inflateGzipChunk() -> std::vector<char> {
+        auto out = std::vector<char>(ChunkSize);
+        zs.next_out  = reinterpret_cast<Bytef*>(out.data());
+        zs.avail_out = out.size();
+        while (zs.avail_out > 0 && !zsEnd) {
+            if (zs.avail_in == 0) {
+                ifs.read(zsInput.data(), zsInput.size());
+                zs.next_in  = reinterpret_cast<Bytef*>(zsInput.data());
+                zs.avail_in = ifs.gcount();
+                if (zs.avail_in == 0) {
+                    if (zsInMember) {
+                        throw error_fmt{"truncated gzip stream"};
+                    }
+                    zsEnd = true;
+                    break;
+                }
+            }
+            auto r = inflate(&zs, Z_NO_FLUSH);
+            zsInMember = r != Z_STREAM_END;
+            if (r == Z_STREAM_END) {
+                // multiple gzip members can follow each other
+                if (inflateReset(&zs) != Z_OK) {
+                    throw error_fmt{"failed resetting gzip stream"};
+                }
+            } else if (r != Z_OK && r != Z_BUF_ERROR) {
+                throw error_fmt{"failed decompressing gzip data: {}", zs.msg?zs.msg:"unknown error"};
+            }
+        }
+        out.resize(out.size() - zs.avail_out);
+        return out;
+    }
+
+    // inflates a batch of complete bgzf blocks
+    static auto inflateBgzfBlocks(std::vector<char> const& blocks) -> std::vector<char> {
+        auto out = std::vector<char>{};
+        size_t pos{};
+        while (pos < blocks.size()) {
+            auto const* block = reinterpret_cast<uint8_t const*>(blocks.data() + pos);
+            size_t xlen       = block[10] | (block[11] << 8);
+            size_t blockSize  = (block[16] | (block[17] << 8)) + 1;
+            size_t isize      = block[blockSize-4] | (block[blockSize-3] << 8) | (block[blockSize-2] << 16) | (size_t{block[blockSize-1]} << 24);
+            pos += blockSize;
+            // empty blocks (e.g. the eof marker) might be a batch of their own, out.data() could be null
+            if (isize == 0) continue;
+
+            auto start = out.size();
+            out.resize(start + isize);
+
+            auto s = z_stream{};
+            if (inflateInit2(&s, -15) != Z_OK) {
+                throw error_fmt{"failed initializing bgzf decompression"};
+            }
+            s.next_in   = const_cast<Bytef*>(block + 12 + xlen);
+            s.avail_in  = blockSize - 12 - xlen - 8;
+            s.next_out  = reinterpret_cast<Bytef*>(out.data() + start);
+            s.avail_out = isize;
+            auto r = inflate(&s, Z_FINISH);
+            inflateEnd(&s);
+            if (r != Z_STREAM_END) {
+                throw error_fmt{"failed decompressing bgzf block"};
+            }
+        }
+        return out;
+    }
+
+    // reads complete bgzf blocks with a total size of about ChunkSize
+    auto readBgzfBlocks() -> std::vector<char> {
+        auto blocks = std::vector<char>{};
+        while (blocks.size() < ChunkSize) {
+            auto header = std::array<uint8_t, 18>{};
+            ifs.read(reinterpret_cast<char*>(header.data()), header.size());
+            if (ifs.gcount() == 0) break;
+            if (ifs.gcount() != 18 || header[0] != 0x1f || header[1] != 0x8b || header[12] != 'B' || header[13] != 'C') {
+                throw error_fmt{"invalid bgzf block header"};
+            }
+            size_t blockSize = (header[16] | (header[17] << 8)) + 1;
+            auto start = blocks.size();
+            blocks.resize(start + blockSize);
+            std::copy(header.begin(), header.end(), blocks.begin() + start);
+            ifs.read(blocks.data() + start + header.size(), blockSize - header.size());
+            if (size_t(ifs.gcount()) != blockSize - header.size()) {
+                throw error_fmt{"truncated bgzf block"};
+            }
+        }
+        return blocks;
+    }
+
+    // keeps enough chunks in flight
+    void schedule() {
+        if (compression == Compression::Gzip) {
+            if (pending.empty() && !zsEnd) {
+                pending.push_back(std::async(std::launch::async, [this]() { return inflateGzipChunk(); }));
+            }
+            return;
+        }
+        while (pending.size() < threadNbr) {
+            auto blocks = readBgzfBlocks();
+            if (blocks.empty()) break;
+            pending.push_back(std::async(std::launch::async, [blocks = std::move(blocks)]() {
+                return inflateBgzfBlocks(blocks);
+            }));
+        }
+    }
+
+protected:
+    auto underflow() -> int_type override {
+        while (gptr() == egptr()) {
+            if (pending.empty()) {
+                return traits_type::eof();
+            }
+            // removed before get(), which rethrows errors of the task
+            auto next = std::move(pending.front());
+            pending.pop_front();
+            current = next.get();
+            schedule();
+            setg(current.data(), current.data(), current.data() + current.size());
+        }
+        return traits_type::to_int_type(*gptr());
+    }
+
+public:
+    DecompressStreamBuf(std::filesystem::path const& path, Compression _compression, size_t _threadNbr)
+        : ifs{path, std::ios::binary}
+        , compression{_compression}
+        , threadNbr{std::max(size_t{1}, _threadNbr)}
+    {
+        if (!ifs) {
+            throw error_fmt{"failed opening file {}", path};
+        }
+        if (compression == Compression::Gzip) {
+            if (inflateInit2(&zs, 15 + 32) != Z_OK) {
+                throw error_fmt{"failed initializing gzip decompression"};
+            }
+        }
+        schedule();
+    }
+
+    DecompressStreamBuf(DecompressStreamBuf const&) = delete;
+    auto operator=(DecompressStreamBuf const&) -> DecompressStreamBuf& = delete;
+
+    ~DecompressStreamBuf() override {
+        // running tasks access this object
+        for (auto& f : pending) {
+            if (f.valid()) f.wait();
+        }
+        if (compression == Compression::Gzip) {
+            inflateEnd(&zs);
+        }
+    }
+};
+
+// input stream over a gzip or bgzf compressed file
+struct DecompressStream : std::istream {
+    std::unique_ptr<DecompressStreamBuf> buf;
+
+    DecompressStream(std::filesystem::path const& path, Compression compression, size_t threadNbr)
+        : std::istream{nullptr}
+        , buf{std::make_unique<DecompressStreamBuf>(path, compression, threadNbr)}
+    {
+        rdbuf(buf.get());
+        exceptions(std::ios::badbit);
+    }
+};
+
+// default number of threads used to decompress bgzf files
+inline auto defaultDecompressThreads() -> size_t {
+    return std::clamp<size_t>(std::thread::hardware_concurrency(), 1, 8);
+}
@@ -0,0 +1,171 @@
+// SPDX-FileCopyrightText: 2006-2024, Knut Reinert & Freie Universität Berlin
+// SPDX-FileCopyrightText: 2016-2024, Knut Reinert & MPI für molekulare Genetik
+// SPDX-License-Identifier: BSD-3-Clause
+
+#pragma once
+
+#include "error_fmt.h"
+
+#include <cctype>
+#include <cstdlib>
+#include <filesystem>
+#include <fmt/format.h>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// escapes a string, such that it can be placed between quotes in a json file
+inline auto jsonEscape(std::string const& s) -> std::string {
+    auto r = std::string{};
+    for (auto c : s) {
+        if (c == '"' || c == '\\') r += '\\';
+        if (static_cast<unsigned char>(c) < 0x20) {
+            r += fmt::format("\\u{:04x}", int(c));
+            continue;
+        }
+        r += c;
+    }
+    return r;
+}
+
+/* Minimal json reader, used to read files written by sahara itself
+ *
+ * Objects keep their members in file order. Throws error_fmt on malformed
+ * input.
+ */
+struct JsonValue {
+    enum class Type { Null, Bool, Number, String, Array, Object };
+
+    Type                                           type{Type::Null};
+    bool                                           boolean{};
+    double                                         number{};
+    std::string                                    string;
+    std::vector<JsonValue>                         array;
+    std::vector<std::pair<std::string, JsonValue>> object;
+
+    // member of an object, nullptr if it does not exist
+    auto find(std::string_view key) const -> JsonValue const* {
+        for (auto const& [k, v] : object) {
+            if (k == key) return &v;
+        }
+        return nullptr;
+    }
+
+    static auto parse(std::string_view text) -> JsonValue {
+        size_t pos{};
+        auto value = parseValue(text, pos);
+        skipSpace(text, pos);
+        if (pos != text.size()) {
+            throw error_fmt{"unexpected content at position {} of json document", pos};
+        }
+        return value;
+    }
+
+    static auto load(std::filesystem::path const& path) -> JsonValue {
+        auto ifs = std::ifstream{path, std::ios::binary};
+        if (!ifs) {
+            throw error_fmt{"failed opening file {}", path};
+        }
+        auto text = std::string{std::istreambuf_iterator<char>{ifs}, std::istreambuf_iterator<char>{}};
+        return parse(text);
+    }
+
+private:
+    static void skipSpace(std::string_view text, size_t& pos) {
+        while (pos < text.size() && std::isspace(static_cast<unsigned char>(text[pos]))) ++pos;
+    }
+
+    static void expect(std::string_view text, size_t& pos, char c) {
+        skipSpace(text, pos);
+        if (pos >= text.size() || text[pos] != c) {
+            throw error_fmt{"expected '{}' at position {} of json document", c, pos};
+        }
+        ++pos;
+    }
+
+    static auto parseString(std::string_view text, size_t& pos) -> std::string {
+        expect(text, pos, '"');
+        auto r = std::string{};
+        while (pos < text.size() && text[pos] != '"') {
+            auto c = text[pos++];
+            if (c == '\\' && pos < text.size()) {
+                c = text[pos++];
+                switch (c) {
+                case 'n': r += '\n'; break;
+                case 't': r += '\t'; break;
+                case 'r': r += '\r'; break;
+                case 'b': r += '\b'; break;
+                case 'f': r += '\f'; break;
+                case 'u':
+                    // only code points below 0x80 are written by jsonEscape
+                    r += char(std::stoi(std::string{text.substr(pos, 4)}, nullptr, 16));
+                    pos += 4;
+                    break;
+                default: r += c;
+                }
+                continue;
+            }
+            r += c;
+        }
+        expect(text, pos, '"');
+        return r;
+    }
+
+    static auto parseValue(std::string_view text, size_t& pos) -> JsonValue {
+        skipSpace(text, pos);
+        if (pos >= text.size()) {
+            throw error_fmt{"unexpected end of json document"};
+        }
+        auto value = JsonValue{};
+        auto c = text[pos];
+        if (c == '{') {
+            value.type = Type::Object;
+            ++pos;
+            skipSpace(text, pos);
+            if (pos < text.size() && text[pos] == '}') { ++pos; return value; }
+            while (true) {
+                auto key = parseString(text, pos);
+                expect(text, pos, ':');
+                value.object.emplace_back(std::move(key), parseValue(text, pos));
+                skipSpace(text, pos);
+                if (pos < text.size() && text[pos] == ',') { ++pos; continue; }
+                expect(text, pos, '}');
+                return value;
+            }
+        } else if (c == '[') {
+            value.type = Type::Array;
+            ++pos;
+            skipSpace(text, pos);
+            if (pos < text.size() && text[pos] == ']') { ++pos; return value; }
+            while (true) {
+                value.array.emplace_back(parseValue(text, pos));
+                skipSpace(text, pos);
+                if (pos < text.size() && text[pos] == ',') { ++pos; continue; }
+                expect(text, pos, ']');
+                return value;
+            }
+        } else if (c == '"') {
+            value.type   = Type::String;
+            value.string = parseString(text, pos);
+        } else if (text.substr(pos, 4) == "true" || text.substr(pos, 5) == "false") {
+            value.type    = Type::Bool;
+            value.boolean = text[pos] == 't';
+            pos += value.boolean?4:5;
+        } else if (text.substr(pos, 4) == "null") {
+            pos += 4;
+        } else {
+            auto number = std::string{text.substr(pos, std::min<size_t>(64, text.size() - pos))};
+            char* end{};
+            value.type   = Type::Number;
+            value.number = std::strtod(number.c_str(), &end);
+            if (end == number.c_str()) {
+                throw error_fmt{"invalid json value at position {}", pos};
+            }
+            pos += end - number.c_str();
+        }
+        return value;
+    }
+};
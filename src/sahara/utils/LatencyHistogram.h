@@ -0,0 +1,85 @@
+// SPDX-FileCopyrightText: 2006-2024, Knut Reinert & Freie Universität Berlin
+// SPDX-FileCopyrightText: 2016-2024, Knut Reinert & MPI für molekulare Genetik
+// SPDX-License-Identifier: BSD-3-Clause
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// cheap monotonic tick counter (time stamp counter on x86, steady clock in ns elsewhere)
+inline auto readCycleCounter() -> uint64_t {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+/* Histogram with logarithmic buckets
+ *
+ * Each power of two is split into 8 buckets, so reported percentiles are off
+ * by at most 12.5%. Values are ticks of readCycleCounter(), they are
+ * converted to seconds with `ticksPerSecond`, which has to be measured by
+ * the caller (e.g. ticks of a whole stage divided by its duration).
+ */
+struct LatencyHistogram {
+    static constexpr size_t SubBuckets = 8;
+    static constexpr size_t SubBits    = 3;
+
+    std::array<uint64_t, (64 - SubBits + 1) * SubBuckets> counts{}; // bucket(UINT64_MAX) is the last bucket
+    uint64_t total{};
+    uint64_t maxValue{};
+
+    static auto bucket(uint64_t v) -> size_t {
+        if (v < 2*SubBuckets) return v;
+        size_t e = std::bit_width(v) - 1; // e >= SubBits+1
+        return (e - SubBits + 1) * SubBuckets + ((v >> (e - SubBits)) & (SubBuckets-1));
+    }
+
+    // smallest value of a bucket
+    static auto lowerBound(size_t b) -> uint64_t {
+        if (b < 2*SubBuckets) return b;
+        size_t e = b / SubBuckets + SubBits - 1;
+        return (uint64_t{1} << e) | (uint64_t{b % SubBuckets} << (e - SubBits));
+    }
+
+    void add(uint64_t v) {
+        counts[bucket(v)] += 1;
+        total += 1;
+        maxValue = std::max(maxValue, v);
+    }
+
+    void add(LatencyHistogram const& other) {
+        for (size_t i{0}; i < counts.size(); ++i) {
+            counts[i] += other.counts[i];
+        }
+        total += other.total;
+        maxValue = std::max(maxValue, other.maxValue);
+    }
+
+    // value below which a fraction p (0..1) of all values lies, reported as middle of the bucket, p >= 1 is the exact maximum
+    auto percentile(double p) const -> uint64_t {
+        if (total == 0) return 0;
+        if (p >= 1.) return maxValue;
+        auto rank = uint64_t(p * total);
+        if (rank >= total) rank = total-1;
+        uint64_t seen{};
+        for (size_t i{0}; i < counts.size(); ++i) {
+            seen += counts[i];
+            if (seen > rank) {
+                auto lb = lowerBound(i);
+                auto ub = i+1 < counts.size() ? lowerBound(i+1) : maxValue;
+                return std::min(maxValue, lb + (ub - lb) / 2);
+            }
+        }
+        return maxValue;
+    }
+};
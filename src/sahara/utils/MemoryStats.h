@@ -0,0 +1,30 @@
+// SPDX-FileCopyrightText: 2006-2024, Knut Reinert & Freie Universität Berlin
+// SPDX-FileCopyrightText: 2016-2024, Knut Reinert & MPI für molekulare Genetik
+// SPDX-License-Identifier: BSD-3-Clause
+
+#pragma once
+
+#include <cstddef>
+#include <fstream>
+#include <string>
+#include <sys/resource.h>
+#include <unistd.h>
+
+// high water mark of the resident set size of this process in bytes
+inline auto peakRss() -> size_t {
+    auto usage = rusage{};
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+    return size_t(usage.ru_maxrss) * 1024; // ru_maxrss is given in KiB on linux
+}
+
+// current resident set size of this process in bytes
+inline auto currentRss() -> size_t {
+    auto ifs = std::ifstream{"/proc/self/statm"};
+    size_t pages{}, resident{};
+    if (!(ifs >> pages >> resident)) {
+        return 0;
+    }
+    return resident * size_t(sysconf(_SC_PAGESIZE));
+}
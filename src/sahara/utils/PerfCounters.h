@@ -0,0 +1,107 @@
+// SPDX-FileCopyrightText: 2006-2024, Knut Reinert & Freie Universität Berlin
+// SPDX-FileCopyrightText: 2016-2024, Knut Reinert & MPI für molekulare Genetik
+// SPDX-License-Identifier: BSD-3-Clause
+
+#pragma once
+
+#include <array>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <string>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <tuple>
+#include <unistd.h>
+
+/* Hardware performance counters of the calling thread (perf_event_open)
+ *
+ * Each counter is opened on its own, counters that the machine or the
+ * kernel settings (perf_event_paranoid) do not allow are reported as not
+ * available instead of failing. Only the thread that opened the counters is
+ * measured, other threads have to open their own.
+ */
+struct PerfCounters {
+    static constexpr size_t Count = 5;
+    static constexpr std::array<char const*, Count> Names = {"cycles", "instructions", "LLC misses", "dTLB misses", "branch misses"};
+
+    using Values = std::array<uint64_t, Count>;
+
+private:
+    std::array<int, Count> fds;
+    std::string            error; // reason of the first counter that failed to open
+
+    static auto open(uint32_t type, uint64_t config) -> int {
+        auto attr = perf_event_attr{};
+        attr.size           = sizeof(attr);
+        attr.type           = type;
+        attr.config         = config;
+        attr.disabled       = 1;
+        attr.inherit        = 0;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv     = 1;
+        return syscall(SYS_perf_event_open, &attr, /*pid=*/0, /*cpu=*/-1, /*group_fd=*/-1, 0);
+    }
+
+    static constexpr auto cacheMiss(uint64_t cache) -> uint64_t {
+        return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    }
+
+public:
+    PerfCounters() {
+        auto events = std::array<std::tuple<uint32_t, uint64_t>, Count>{{
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+            {PERF_TYPE_HW_CACHE, cacheMiss(PERF_COUNT_HW_CACHE_LL)},
+            {PERF_TYPE_HW_CACHE, cacheMiss(PERF_COUNT_HW_CACHE_DTLB)},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+        }};
+        for (size_t i{0}; i < Count; ++i) {
+            auto [type, config] = events[i];
+            fds[i] = open(type, config);
+            if (fds[i] < 0) {
+                if (error.empty()) error = std::string{Names[i]} + ": " + std::strerror(errno);
+                continue;
+            }
+            ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+
+    PerfCounters(PerfCounters const&) = delete;
+    auto operator=(PerfCounters const&) -> PerfCounters& = delete;
+
+    ~PerfCounters() {
+        for (auto fd : fds) {
+            if (fd >= 0) close(fd);
+        }
+    }
+
+    auto available(size_t i) const -> bool {
+        return fds[i] >= 0;
+    }
+
+    auto anyAvailable() const -> bool {
+        for (size_t i{0}; i < Count; ++i) {
+            if (available(i)) return true;
+        }
+        return false;
+    }
+
+    // reason why (some) counters are not available, empty if all are available
+    auto errorMessage() const -> std::string const& {
+        return error;
+    }
+
+    // current values, unavailable counters are 0
+    auto read() const -> Values {
+        auto values = Values{};
+        for (size_t i{0}; i < Count; ++i) {
+            if (fds[i] < 0 || ::read(fds[i], &values[i], sizeof(uint64_t)) != sizeof(uint64_t)) {
+                values[i] = 0;
+            }
+        }
+        return values;
+    }
+};
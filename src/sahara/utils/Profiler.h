@@ -0,0 +1,368 @@
+// SPDX-FileCopyrightText: 2006-2024, Knut Reinert & Freie Universität Berlin
+// SPDX-FileCopyrightText: 2016-2024, Knut Reinert & MPI für molekulare Genetik
+// SPDX-License-Identifier: BSD-3-Clause
+
+#pragma once
+
+#include "AllocationStats.h"
+#include "Json.h"
+#include "MemoryStats.h"
+#include "PerfCounters.h"
+#include "StopWatch.h"
+#include "error_fmt.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <fmt/format.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <vector>
+
+/* Process wide profiler
+ *
+ * Every thread records into its own timeline: nested scopes (begin/end
+ * relative to the start of the profiler) and counters. Recording only takes
+ * a lock when a thread records for the first time. The collected data can be
+ * written as a stats json file or as a chrome trace-event file (viewable with
+ * chrome://tracing or https://ui.perfetto.dev).
+ */
+struct Profiler {
+    struct Event {
+        std::string name;
+        size_t      depth;
+        double      begin; // seconds since start of the profiler
+        double      end;
+    };
+
+    struct Timeline {
+        size_t                         id;
+        std::string                    name;
+        size_t                         depth{};
+        std::vector<Event>             events;
+        std::map<std::string, int64_t> counters;
+        std::unique_ptr<PerfCounters>  perf;       // counters of this thread, if enabled
+        PerfCounters::Values           perfLast{}; // counter values at the end of the last stage
+        size_t                         rssLast{};  // resident set size at the end of the last stage
+        AllocationStats                allocLast{};
+    };
+
+    // memory usage of a stage, resident set size and allocations are process wide
+    struct StageMemory {
+        int64_t  rssDelta{};
+        size_t   peakRss{};   // high water mark at the end of the stage
+        uint64_t allocations{};
+        uint64_t allocatedBytes{};
+    };
+
+    // a scope, which is recorded in the timeline of the current thread when it ends
+    struct Scope {
+        std::string name;
+        size_t      depth;
+        double      begin;
+
+        explicit Scope(std::string _name)
+            : name{std::move(_name)}
+            , depth{Profiler::instance().timeline().depth++}
+            , begin{Profiler::instance().now()}
+        {}
+        Scope(Scope const&) = delete;
+        auto operator=(Scope const&) -> Scope& = delete;
+
+        ~Scope() {
+            auto& profiler = Profiler::instance();
+            auto& timeline = profiler.timeline();
+            timeline.depth -= 1;
+            timeline.events.push_back({std::move(name), depth, begin, profiler.now()});
+        }
+    };
+
+private:
+    StopWatch                              watch;
+    std::mutex                             mutex;
+    std::vector<std::unique_ptr<Timeline>> timelines;
+
+    std::atomic<bool>                                           perfEnabled{};
+    std::vector<std::tuple<std::string, PerfCounters::Values>> perfStages;   // summed by stage name
+    std::vector<std::tuple<std::string, StageMemory>>          memoryStages; // summed by stage name, maximum of peakRss
+
+    size_t          startRss{currentRss()}; // the main timeline starts together with the profiler
+    AllocationStats startAllocations{allocationStats()};
+
+public:
+    static auto instance() -> Profiler& {
+        static Profiler profiler;
+        return profiler;
+    }
+
+    // seconds since the start of the profiler
+    auto now() const -> double {
+        return watch.peek();
+    }
+
+    // timeline of the calling thread
+    auto timeline() -> Timeline& {
+        thread_local Timeline* current{};
+        if (!current) {
+            auto lock = std::unique_lock{mutex};
+            timelines.emplace_back(std::make_unique<Timeline>());
+            current       = timelines.back().get();
+            current->id   = timelines.size();
+            current->name = current->id == 1 ? "main" : fmt::format("thread {}", current->id-1);
+            if (perfEnabled) openPerfCounters(*current);
+            current->rssLast   = current->id == 1 ? startRss : currentRss();
+            current->allocLast = current->id == 1 ? startAllocations : allocationStats();
+        }
+        return *current;
+    }
+
+    /* Records the hardware counters of every stage (see stage()). Every
+     * thread measures itself with its own counters, opened when it records
+     * for the first time, stages with the same name are summed over all
+     * threads. Returns the counters of the calling thread.
+     */
+    auto enablePerfCounters() -> PerfCounters const& {
+        perfEnabled = true;
+        auto& t = timeline();
+        if (!t.perf) openPerfCounters(t);
+        return *t.perf;
+    }
+
+    // stops recording the hardware counters, already recorded stages are kept
+    void disablePerfCounters() {
+        perfEnabled = false;
+    }
+
+    // perf counter values of each stage, in order of first occurrence
+    auto perfStageValues() -> std::vector<std::tuple<std::string, PerfCounters::Values>> {
+        auto lock = std::unique_lock{mutex};
+        return perfStages;
+    }
+
+    // memory usage of all stages with this name
+    auto stageMemory(std::string const& name) -> StageMemory {
+        auto lock = std::unique_lock{mutex};
+        for (auto const& [key, memory] : memoryStages) {
+            if (key == name) return memory;
+        }
+        return {};
+    }
+
+    void setThreadName(std::string name) {
+        timeline().name = std::move(name);
+    }
+
+    // adds value to a counter of the calling thread
+    void count(std::string const& name, int64_t value = 1) {
+        timeline().counters[name] += value;
+    }
+
+    /* Records the time since the last reset of `stopWatch` as an event named
+     * `name` and resets the stop watch. The return value fits into the
+     * `timing` vectors of the subcommands.
+     */
+    auto stage(std::string name, StopWatch& stopWatch) -> std::tuple<std::string, double> {
+        auto seconds  = stopWatch.reset();
+        auto end      = now();
+        auto& t       = timeline();
+        t.events.push_back({name, t.depth, end - seconds, end});
+        if (perfEnabled) {
+            if (!t.perf) openPerfCounters(t); // thread started before the counters were enabled
+            auto values = t.perf->read();
+            auto delta  = PerfCounters::Values{};
+            for (size_t i{0}; i < values.size(); ++i) {
+                delta[i] = values[i] - t.perfLast[i];
+            }
+            t.perfLast = values;
+            addPerfStage(name, delta);
+        }
+        {
+            auto rss    = currentRss();
+            auto allocs = allocationStats();
+            addMemoryStage(name, {
+                .rssDelta       = int64_t(rss) - int64_t(t.rssLast),
+                .peakRss        = peakRss(),
+                .allocations    = allocs.allocations - t.allocLast.allocations,
+                .allocatedBytes = allocs.bytes - t.allocLast.bytes,
+            });
+            t.rssLast   = rss;
+            t.allocLast = allocs;
+        }
+        return {std::move(name), seconds};
+    }
+
+    // counters summed over all threads
+    auto counters() -> std::map<std::string, int64_t> {
+        auto lock = std::unique_lock{mutex};
+        auto res  = std::map<std::string, int64_t>{};
+        for (auto const& t : timelines) {
+            for (auto const& [key, value] : t->counters) {
+                res[key] += value;
+            }
+        }
+        return res;
+    }
+
+    /* Writes a json file with the top level stages (`timing`), additional
+     * values, all scopes aggregated by their path (e.g. "shard 0/search") and
+     * the counters of all threads.
+     */
+    void writeStatsJson(std::filesystem::path const& path, std::string const& command, std::vector<std::tuple<std::string, double>> const& timing, std::vector<std::tuple<std::string, double>> const& values) {
+        auto summedCounters = counters();
+        auto lock = std::unique_lock{mutex};
+
+        auto ofs = fopen(path.c_str(), "w");
+        if (!ofs) {
+            throw error_fmt{"failed opening file {}", path};
+        }
+        fmt::print(ofs, "{{\n  \"command\": \"{}\",\n  \"stages\": [", jsonEscape(command));
+        double totalTime{};
+        for (size_t i{0}; i < timing.size(); ++i) {
+            auto const& [key, time] = timing[i];
+            auto memory = StageMemory{};
+            for (auto const& [name, m] : memoryStages) {
+                if (name == key) memory = m;
+            }
+            fmt::print(ofs, "{}\n    {{\"name\": \"{}\", \"seconds\": {}, \"rss_delta_bytes\": {}, \"peak_rss_bytes\": {}",
+                       i?",":"", jsonEscape(key), time, memory.rssDelta, memory.peakRss);
+            if (allocationTrackingEnabled()) {
+                fmt::print(ofs, ", \"allocations\": {}, \"allocated_bytes\": {}", memory.allocations, memory.allocatedBytes);
+            }
+            fmt::print(ofs, "}}");
+            totalTime += time;
+        }
+        fmt::print(ofs, "\n  ],\n  \"total_seconds\": {},\n  \"values\": {{", totalTime);
+        for (size_t i{0}; i < values.size(); ++i) {
+            auto const& [key, value] = values[i];
+            fmt::print(ofs, "{}\n    \"{}\": {}", i?",":"", jsonEscape(key), value);
+        }
+        fmt::print(ofs, "\n  }},\n  \"counters\": {{");
+        {
+            bool first{true};
+            for (auto const& [key, value] : summedCounters) {
+                fmt::print(ofs, "{}\n    \"{}\": {}", first?"":",", jsonEscape(key), value);
+                first = false;
+            }
+        }
+        fmt::print(ofs, "\n  }},\n  \"perf_counters\": [");
+        for (size_t i{0}; i < perfStages.size(); ++i) {
+            auto const& [key, values] = perfStages[i];
+            fmt::print(ofs, "{}\n    {{\"stage\": \"{}\"", i?",":"", jsonEscape(key));
+            for (size_t j{0}; j < values.size(); ++j) {
+                if (timelines.front()->perf && timelines.front()->perf->available(j)) {
+                    fmt::print(ofs, ", \"{}\": {}", jsonEscape(PerfCounters::Names[j]), values[j]);
+                }
+            }
+            fmt::print(ofs, "}}");
+        }
+        fmt::print(ofs, "\n  ],\n  \"threads\": [");
+        for (size_t i{0}; i < timelines.size(); ++i) {
+            auto const& t = *timelines[i];
+
+            // aggregate scopes by their path, after sorting by begin each event follows its parent
+            auto scopes = std::map<std::string, std::tuple<size_t, double>>{};
+            auto events = t.events;
+            std::ranges::sort(events, [](auto const& lhs, auto const& rhs) {
+                return std::tie(lhs.begin, lhs.depth) < std::tie(rhs.begin, rhs.depth);
+            });
+            auto stack = std::vector<std::string>{};
+            for (auto const& e : events) {
+                stack.resize(std::min(stack.size(), e.depth));
+                auto name = stack.empty() ? e.name : stack.back() + "/" + e.name;
+                stack.push_back(name);
+                auto& [calls, seconds] = scopes[name];
+                calls   += 1;
+                seconds += e.end - e.begin;
+            }
+
+            fmt::print(ofs, "{}\n    {{\"id\": {}, \"name\": \"{}\", \"scopes\": [", i?",":"", t.id, jsonEscape(t.name));
+            bool first{true};
+            for (auto const& [name, v] : scopes) {
+                auto const& [calls, seconds] = v;
+                fmt::print(ofs, "{}\n      {{\"path\": \"{}\", \"calls\": {}, \"seconds\": {}}}", first?"":",", jsonEscape(name), calls, seconds);
+                first = false;
+            }
+            fmt::print(ofs, "\n    ], \"counters\": {{");
+            first = true;
+            for (auto const& [key, value] : t.counters) {
+                fmt::print(ofs, "{}\"{}\": {}", first?"":", ", jsonEscape(key), value);
+                first = false;
+            }
+            fmt::print(ofs, "}}}}");
+        }
+        fmt::print(ofs, "\n  ]\n}}\n");
+        fclose(ofs);
+    }
+
+    // Writes all events in the chrome trace-event format, counters are reported at the end of each thread
+    void writeChromeTrace(std::filesystem::path const& path) {
+        auto lock = std::unique_lock{mutex};
+
+        auto ofs = fopen(path.c_str(), "w");
+        if (!ofs) {
+            throw error_fmt{"failed opening file {}", path};
+        }
+        fmt::print(ofs, "{{\"traceEvents\": [\n");
+        bool first{true};
+        auto sep = [&]() {
+            auto r = first?"":",\n";
+            first = false;
+            return r;
+        };
+        for (auto const& t : timelines) {
+            fmt::print(ofs, "{}{{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": {}, \"args\": {{\"name\": \"{}\"}}}}", sep(), t->id, jsonEscape(t->name));
+            double lastEnd{};
+            for (auto const& e : t->events) {
+                fmt::print(ofs, "{}{{\"name\": \"{}\", \"ph\": \"X\", \"pid\": 1, \"tid\": {}, \"ts\": {:.3f}, \"dur\": {:.3f}}}",
+                           sep(), jsonEscape(e.name), t->id, e.begin * 1'000'000., (e.end - e.begin) * 1'000'000.);
+                lastEnd = std::max(lastEnd, e.end);
+            }
+            for (auto const& [key, value] : t->counters) {
+                fmt::print(ofs, "{}{{\"name\": \"{}\", \"ph\": \"C\", \"pid\": 1, \"tid\": {}, \"ts\": {:.3f}, \"args\": {{\"value\": {}}}}}",
+                           sep(), jsonEscape(key), t->id, lastEnd * 1'000'000., value);
+            }
+        }
+        fmt::print(ofs, "\n]}}\n");
+        fclose(ofs);
+    }
+
+private:
+    Profiler() = default;
+
+    // counters count from here on, the next stage of the thread starts now
+    static void openPerfCounters(Timeline& t) {
+        t.perf     = std::make_unique<PerfCounters>();
+        t.perfLast = t.perf->read();
+    }
+
+    void addPerfStage(std::string const& name, PerfCounters::Values const& delta) {
+        auto lock = std::unique_lock{mutex};
+        for (auto& [key, values] : perfStages) {
+            if (key == name) {
+                for (size_t i{0}; i < values.size(); ++i) {
+                    values[i] += delta[i];
+                }
+                return;
+            }
+        }
+        perfStages.emplace_back(name, delta);
+    }
+
+    void addMemoryStage(std::string const& name, StageMemory const& memory) {
+        auto lock = std::unique_lock{mutex};
+        for (auto& [key, m] : memoryStages) {
+            if (key == name) {
+                m.rssDelta       += memory.rssDelta;
+                m.peakRss         = std::max(m.peakRss, memory.peakRss);
+                m.allocations    += memory.allocations;
+                m.allocatedBytes += memory.allocatedBytes;
+                return;
+            }
+        }
+        memoryStages.emplace_back(name, memory);
+    }
+};